@@ -167,11 +167,16 @@ protcetmode_beginning:
     
     ; 加载kernel，从硬盘读取到物理内存
     ; 这里为了简单，选择了在开启分页之前加载
+    ; 0x1f2端口是8位的, 一次最多读255个扇区, 故分两次读入共280个扇区
     mov eax, KERNEL_START_SECTOR    ; kernel.bin在硬盘中的扇区号
     mov ebx, KERNEL_BIN_BASE_ADDR   ; 从磁盘读出后，写入到ebx指定的物理内存地址
     mov ecx, 200			        ; 读入的扇区数
     call read_hard_disk_0
     
+    mov eax, KERNEL_START_SECTOR + 200  ; ebx已在read_hard_disk_0中后移到第一次读入的数据之后
+    mov ecx, 80
+    call read_hard_disk_0
+    
     
 
     ; 创建页目录及页表
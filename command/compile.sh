@@ -13,12 +13,13 @@ then
 fi
 
 
-BIN="cat"
+# 要编译的程序名, 默认为cat, 如 ./compile.sh malloc_test
+BIN=${1:-"cat"}
 CFLAGS="-m32 -Wall -c -fno-builtin -W -Wstrict-prototypes \
       -Wmissing-prototypes -Wsystem-headers"
 LIBS="-I ../lib/ -I ../kernel -I ../user -I ../device \
      -I ../thread -I ../fs -I ../shell"
-OBJS="../build/string.o ../build/syscall.o \
+OBJS="../build/string.o ../build/syscall.o ../build/malloc.o \
       ../build/stdio.o ../build/assert.o start.o"
 
 DD_IN=$BIN
@@ -26,7 +27,7 @@ DD_OUT="../hd60M.img"
 
 nasm -f elf ./start.asm -o ./start.o
 
-# ar 命令将 string.o syscall.o stdio.o assert.o start.o 打包成静态库文件 simple_crt.a
+# ar 命令将 string.o syscall.o malloc.o stdio.o assert.o start.o 打包成静态库文件 simple_crt.a
 # simple_str.a 类似于CRT的作用
 ar rcs simple_crt.a $OBJS start.o
 
@@ -0,0 +1,80 @@
+#include "stdio.h"
+
+#include "syscall.h"
+#include "string.h"
+
+#define NULL ((void *)0)
+
+#define TEST_FILE   "/malloc_test.tmp"
+#define CHUNK_SIZE  200         // 按小块申请, 逐页用完后malloc要通过sbrk扩大堆
+#define CHUNK_COUNT 100
+
+
+/* 申请CHUNK_COUNT块内存并写满, 全部成功返回1 */
+static int malloc_chunks(const char *stage)
+{
+    int idx;
+    for(idx = 0; idx < CHUNK_COUNT; idx++)
+    {
+        char *chunk = malloc(CHUNK_SIZE);
+        if(chunk == NULL)
+        {
+            printf("malloc_test: malloc failed after %s, chunk %d\n", stage, idx);
+            return 0;
+        }
+        memset(chunk, idx, CHUNK_SIZE);
+    }
+    return 1;
+}
+
+
+/* 检查堆在mmap和打开文件之后仍能扩大
+ * 打开、创建文件时内核会在进程上下文中调用sys_malloc, 从进程用户空间取内存 */
+int main(void)
+{
+    int failed = 0;
+    
+    if(!malloc_chunks("start"))
+        failed = 1;
+    
+    void *map = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED)
+    {
+        printf("malloc_test: mmap failed\n");
+        failed = 1;
+    }
+    else
+    {
+        memset(map, 0x5a, 4096);
+        if(!malloc_chunks("mmap"))
+            failed = 1;
+        munmap(map, 4096);
+    }
+    
+    int fd = open(TEST_FILE, O_CREAT | O_RDWR);
+    if(fd == -1)
+    {
+        printf("malloc_test: create %s failed\n", TEST_FILE);
+        failed = 1;
+    }
+    else
+    {
+        close(fd);
+        fd = open(TEST_FILE, O_RDONLY);
+        if(fd != -1)
+            close(fd);
+        if(!malloc_chunks("open"))
+            failed = 1;
+        unlink(TEST_FILE);
+    }
+    
+    // 直接扩大堆, 堆之后的地址不能被别的区域占掉
+    if(sbrk(8192) == (void *)-1)
+    {
+        printf("malloc_test: sbrk failed\n");
+        failed = 1;
+    }
+    
+    printf("malloc_test: %s\n", failed ? "FAILED" : "PASSED");
+    return failed;
+}
@@ -18,7 +18,6 @@
 #include "interrupt.h"
 #include "debug.h"
 
-#define IRQ0_FREQUENCY      100     // 时钟中断的频率，这里我们设置为100Hz    
 #define INPUT_FREQUENCY     1193180 // 计数器0的工作脉冲信号频率
 #define TIMER0_VALUE        INPUT_FREQUENCY / IRQ0_FREQUENCY    // 计数器的计数初值
 #define TIMER0_PORT         0x40    // 端口号，用来指定初始值value的目的端口号
@@ -67,7 +66,12 @@ static void intr_timer_handler(void)
     ticks++;    // 从内核第一次处理时间中断后开始至今的嘀嗒数，内核态和用户态总共的嘀嗒数
                 // 实际上就是时钟中断发生的次数
     
-    if(current_thread->ticks == 0)  // 若进程时间片用完，就开始调度新的进程上CPU
+    // 定期老化, 让久居低级别的任务也能升上来
+    if(ticks % MLFQ_AGING_TICKS == 0)
+        thread_aging();
+    
+    // 若进程时间片用完, 或有更高级别的任务就绪, 就开始调度新的进程上CPU
+    if(current_thread->ticks == 0 || thread_need_preempt(current_thread))
         schedule();
     else
         // 每个线程在处理器上运行期间都会有很多次时钟中断发生，每次中断处理程序都会将线程的时间片ticks减1
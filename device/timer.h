@@ -3,6 +3,10 @@
 
 #include "stdint.h"
 
+#define IRQ0_FREQUENCY      100     // 时钟中断的频率，这里我们设置为100Hz
+
+extern unsigned int ticks;      // 内核自中断开启以来总共的嘀嗒数
+
 void timer_init(void);
 
 void milli_time_sleep(unsigned int milli_seconds);
@@ -7,9 +7,28 @@
 #include "stdio_kernel.h"   // printk
 
 #include "debug.h"      // ASSERT
+#include "slab.h"       // kmem_cache_alloc
 
 struct dir root_dir;    // 分区的根目录
 
+static struct kmem_cache dir_cache;     // 内存中目录对象的缓存
+
+
+/* 目录对象的构造函数 */
+static void dir_ctor(void *obj)
+{
+    struct dir *pdir = obj;
+    pdir->inode = NULL;
+    pdir->dir_pos = 0;
+}
+
+
+/* 创建目录对象缓存 */
+void dir_cache_init(void)
+{
+    kmem_cache_init(&dir_cache, "dir", sizeof(struct dir), dir_ctor);
+}
+
 
 /* 打开根目录 */
 void open_root_dir(struct partition *part)
@@ -23,7 +42,7 @@ void open_root_dir(struct partition *part)
 /* 在分区part上打开i节点为inode_id的目录并返回目录指针 */
 struct dir *dir_open(struct partition *part, unsigned int inode_id)
 {
-    struct dir *pdir = (struct dir *)sys_malloc(sizeof(struct dir));
+    struct dir *pdir = (struct dir *)kmem_cache_alloc(&dir_cache);
     pdir->inode = inode_open(part, inode_id);
     pdir->dir_pos = 0;
     return pdir;
@@ -40,10 +59,10 @@ bool search_dir_entry(struct partition *part, struct dir *pdir, const char *name
     // 12个直接块 + 128个一级间接块, 共560字节
     // all_blocks 是为了方便检索此inode的全部扇区地址, 
     // 以后对此目录inode所在的扇区地址都统一从 all_blocks 中获取
-    unsigned int *all_blocks = (unsigned int *)sys_malloc(48 + 512);
+    unsigned int *all_blocks = (unsigned int *)kmem_cache_alloc(&all_blocks_cache);
     if(all_blocks == NULL)
     {
-        printk("ERROR: during search_dir_entry, sys_malloc for all_blocks failed\n");
+        printk("ERROR: during search_dir_entry, kmem_cache_alloc for all_blocks failed\n");
         return false;
     }
     
@@ -58,14 +77,17 @@ bool search_dir_entry(struct partition *part, struct dir *pdir, const char *name
     
     // 若含有一级间接块表, 就从硬盘的扇区地址inode_sectors[12]处获取1扇区数据, 即128个
     // 间接块地址, 将其复制到 all_blocks+12 字节处
+    // 否则间接块地址全为0. 缓存中的all_blocks不是清0的, 需要在此清0
     if(pdir->inode->inode_blocks[12] != 0)
     { ide_read(part->my_disk, pdir->inode->inode_blocks[12], all_blocks + 12, 1); }
+    else
+    { memset(all_blocks + 12, 0, 512); }
     
     /* 至此, all_blocks存储的是该文件或目录的所有扇区地址 */
     
     // 写目录项的时候已保证目录项不跨扇区
     // 这样读目录项时容易处理, 只申请容纳一个扇区的内存
-    unsigned char *buf = (unsigned char *)sys_malloc(SECTOR_SIZE);
+    unsigned char *buf = (unsigned char *)kmem_cache_alloc(&io_buf_cache);
     // p_de为指向目录项的指针, 值为buf起始地址
     struct dir_entry *p_de = (struct dir_entry *)buf;
     unsigned int dir_entry_size = part->sbk->directory_entry_size;
@@ -93,8 +115,8 @@ bool search_dir_entry(struct partition *part, struct dir *pdir, const char *name
             if(!strcmp(p_de->filename, name))
             {
                 memcpy(dir_e, p_de, dir_entry_size);
-                sys_free(buf);
-                sys_free(all_blocks);
+                kmem_cache_free(&io_buf_cache, buf);
+                kmem_cache_free(&all_blocks_cache, all_blocks);
                 return true;
             }
             dir_entry_index++;
@@ -103,10 +125,9 @@ bool search_dir_entry(struct partition *part, struct dir *pdir, const char *name
         block_index++;
         // 此时p_de已经指向扇区内最后一个完整目录项了, 需要恢复p_de指向为buf
         p_de = (struct dir_entry *)buf;
-        memset(buf, 0, SECTOR_SIZE);    // 将buf清0, 下次再用
     }
-    sys_free(buf);
-    sys_free(all_blocks);
+    kmem_cache_free(&io_buf_cache, buf);
+    kmem_cache_free(&all_blocks_cache, all_blocks);
     return false;
 }
 
@@ -123,7 +144,7 @@ void dir_close(struct dir* dir)
     if (dir == &root_dir)   // 不做任何处理直接返回
     { return; }
     inode_close(dir->inode);
-    sys_free(dir);
+    kmem_cache_free(&dir_cache, dir);
 }
 
 
@@ -499,7 +520,7 @@ signed int dir_remove(struct dir* parent_dir, struct dir* child_dir)
         ASSERT(child_dir_inode->inode_blocks[block_idx] == 0);
         block_idx++;
     }
-    void* io_buf = sys_malloc(SECTOR_SIZE * 2);
+    void* io_buf = kmem_cache_alloc(&io_buf2_cache);
     if (io_buf == NULL)
     {
         printk("dir_remove: malloc for io_buf failed\n");
@@ -511,7 +532,7 @@ signed int dir_remove(struct dir* parent_dir, struct dir* child_dir)
 
     /* 回收inode中i_secotrs中所占用的扇区,并同步inode_bitmap和block_bitmap */
     inode_release(current_part, child_dir_inode->inode_id);
-    sys_free(io_buf);
+    kmem_cache_free(&io_buf2_cache, io_buf);
     return 0;
 }
 
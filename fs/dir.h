@@ -25,6 +25,9 @@ struct dir_entry{
 extern struct dir root_dir;    // 分区的根目录
 
 
+/* 创建目录对象缓存 */
+void dir_cache_init(void);
+
 /* 打开根目录 */
 void open_root_dir(struct partition *part);
 
@@ -10,9 +10,27 @@
 #include "string.h"         // memset
 
 #include "stdio_kernel.h"   // printk
+#include "slab.h"           // kmem_cache_alloc
+#include "image_cache.h"    // image_cache_invalidate
 
 #include "global.h"         // NULL
 
+struct kmem_cache io_buf_cache;         // 1扇区大小的io缓冲区
+struct kmem_cache io_buf2_cache;        // 2扇区大小的io缓冲区, 用于可能跨扇区的inode和目录项
+struct kmem_cache all_blocks_cache;     // 文件全部块地址数组
+
+
+/* 创建文件读写用的缓冲区缓存 */
+// 缓冲区在每次使用前都会被扇区数据或块地址覆盖, 故无需构造函数, 也不必清0
+// ide_read/ide_write的缓冲区不能用sys_malloc从进程的用户堆中申请: 用户页可能被换出,
+// 在PIO传送中途缺页会在同一通道上嵌套一次换入的ide_read, 两次传送都会错乱
+void file_cache_init(void)
+{
+    kmem_cache_init(&io_buf_cache, "io_buf", BLOCK_SIZE, NULL);
+    kmem_cache_init(&io_buf2_cache, "io_buf2", BLOCK_SIZE * 2, NULL);
+    kmem_cache_init(&all_blocks_cache, "all_blocks", ALL_BLOCKS_SIZE, NULL);
+}
+
 #include "debug.h"          // ASSERT
 
 #define DEFAULT_SECTORS     1
@@ -121,10 +139,10 @@ signed int file_create(struct dir *parent_dir, char *filename, unsigned char fla
 {
     // 后续操作的公共资源
     // 考虑到有数据会跨扇区的情况, 故申请2个扇区大小的缓冲区
-    void *io_buf = sys_malloc(1024);
+    void *io_buf = kmem_cache_alloc(&io_buf2_cache);
     if(io_buf == NULL)
     {
-        printk("ERROR: during file_create, sys_malloc for io_buf failed\n");
+        printk("ERROR: during file_create, alloc for io_buf failed\n");
         return -1;
     }
     
@@ -141,7 +159,7 @@ signed int file_create(struct dir *parent_dir, char *filename, unsigned char fla
     
     // 此inode要从堆中申请内存, 不可生成局部变量(函数退出时会释放)
     // 因为file_table数组中的文件描述符的inode指针要指向它
-    struct inode *new_file_inode = (struct inode *)sys_malloc(sizeof(struct inode));
+    struct inode *new_file_inode = (struct inode *)kmem_cache_alloc(&inode_cache);
     if(new_file_inode == NULL)
     {
         printk("ERROR: during file_create, sys_malloc for inode failed\n");
@@ -195,7 +213,7 @@ signed int file_create(struct dir *parent_dir, char *filename, unsigned char fla
     list_push(&current_part->open_inodes, &new_file_inode->inode_tag);
     new_file_inode->inode_open_count = 1;
     
-    sys_free(io_buf);
+    kmem_cache_free(&io_buf2_cache, io_buf);
     return pcb_fd_install(fd_index);
     
 /* 创建文件需要创建相关的多个资源, 若某步失败则会执行到下面的回滚步骤 */
@@ -206,13 +224,13 @@ rollback:
         // 失败时, 将file_table中的相应位清空
         memset(&file_table[fd_index], 0, sizeof(struct file));
     case 2:
-        sys_free(new_file_inode);
+        kmem_cache_free(&inode_cache, new_file_inode);
     case 1:
         // 如果新文件的i结点创建失败, 之前位图中分配的inode_id也要恢复
         bitmap_set(&current_part->inode_bitmap, inode_id, 0);
         break;
     }
-    sys_free(io_buf);
+    kmem_cache_free(&io_buf2_cache, io_buf);
     return -1;
 }
 
@@ -295,20 +313,24 @@ signed int file_write(struct file* file, const void* buf, unsigned int count)
         return -1;
     }
     
+    // 映像缓存中此文件的页可能过时, 去掉它们
+    image_cache_invalidate(file->fd_inode->inode_id);
+    
     // 后面我们的磁盘操作都以1个扇区为单位
-    unsigned char* io_buf = sys_malloc(BLOCK_SIZE);
+    unsigned char* io_buf = kmem_cache_alloc(&io_buf_cache);
     if (io_buf == NULL)
     {
-        printk("file_write: sys_malloc for io_buf failed\n");
+        printk("file_write: kmem_cache_alloc for io_buf failed\n");
         return -1;
     }
     
     // 写硬盘时为了方便获取块地址, 这里把文件所有的块地址收集到 all_blocks 中
     // 128个间接块+ 12个直接块
-    unsigned int* all_blocks = (unsigned int*)sys_malloc(BLOCK_SIZE + 48);	  // 用来记录文件所有的块地址
+    unsigned int* all_blocks = (unsigned int*)kmem_cache_alloc(&all_blocks_cache);	  // 用来记录文件所有的块地址
     if (all_blocks == NULL)
     {
-        printk("file_write: sys_malloc for all_blocks failed\n");
+        printk("file_write: kmem_cache_alloc for all_blocks failed\n");
+        kmem_cache_free(&io_buf_cache, io_buf);
         return -1;
     }
 
@@ -526,8 +548,8 @@ signed int file_write(struct file* file, const void* buf, unsigned int count)
    }
    
    inode_sync(current_part, file->fd_inode, io_buf);    // 同步inode
-   sys_free(all_blocks);
-   sys_free(io_buf);
+   kmem_cache_free(&all_blocks_cache, all_blocks);
+   kmem_cache_free(&io_buf_cache, io_buf);
    return bytes_written;
 }
 
@@ -554,15 +576,19 @@ signed int file_read(struct file* file, void* buf, unsigned int count)
         { return -1; }
     }
 
-    unsigned char* io_buf = sys_malloc(BLOCK_SIZE);
+    unsigned char* io_buf = kmem_cache_alloc(&io_buf_cache);
     if (io_buf == NULL)
-    { printk("file_read: sys_malloc for io_buf failed\n"); }
+    {
+        printk("file_read: kmem_cache_alloc for io_buf failed\n");
+        return -1;
+    }
 
 	// 用来记录文件所有的块地址
-    unsigned int* all_blocks = (unsigned int*)sys_malloc(BLOCK_SIZE + 48);
+    unsigned int* all_blocks = (unsigned int*)kmem_cache_alloc(&all_blocks_cache);
     if (all_blocks == NULL)
     {
-        printk("file_read: sys_malloc for all_blocks failed\n");
+        printk("file_read: kmem_cache_alloc for all_blocks failed\n");
+        kmem_cache_free(&io_buf_cache, io_buf);
         return -1;
     }
 
@@ -644,8 +670,7 @@ signed int file_read(struct file* file, void* buf, unsigned int count)
         sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
         chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes; // 待读入的数据大小
 
-        memset(io_buf, 0, BLOCK_SIZE);
-        ide_read(current_part->my_disk, sec_lba, io_buf, 1);    // 每次读取一个扇区
+        ide_read(current_part->my_disk, sec_lba, io_buf, 1);    // 每次读取一个扇区, 整个io_buf都会被覆盖
         memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);// 拷贝
 
         buf_dst += chunk_size;
@@ -654,10 +679,67 @@ signed int file_read(struct file* file, void* buf, unsigned int count)
         size_left -= chunk_size;
     }
     
-    sys_free(all_blocks);
-    sys_free(io_buf);    
+    kmem_cache_free(&all_blocks_cache, all_blocks);
+    kmem_cache_free(&io_buf_cache, io_buf);
     return bytes_read;
 }
 
 
 
+/* 把buf中的count个字节写到文件inode中从pos开始的位置, 成功返回写入的字节数, 失败返回-1
+ * 只改写文件中已有的内容, 不分配块也不改变文件大小. 供共享的文件映射写回改过的页 */
+signed int file_overwrite(struct inode *inode, unsigned int pos, const void *buf, unsigned int count)
+{
+    if (pos + count > inode->inode_size || pos + count < pos)
+    { return -1; }
+    image_cache_invalidate(inode->inode_id);
+
+    unsigned char* io_buf = kmem_cache_alloc(&io_buf_cache);
+    if (io_buf == NULL)
+    { return -1; }
+    unsigned int* all_blocks = (unsigned int*)kmem_cache_alloc(&all_blocks_cache);
+    if (all_blocks == NULL)
+    {
+        kmem_cache_free(&io_buf_cache, io_buf);
+        return -1;
+    }
+
+    /* 收集用到的块地址, 数据延伸到间接块时读入一级间接块表 */
+    unsigned int block_idx = pos / BLOCK_SIZE;
+    unsigned int block_end_idx = DIV_ROUND_UP(pos + count, BLOCK_SIZE);
+    for (; block_idx < 12 && block_idx < block_end_idx; block_idx++)
+    { all_blocks[block_idx] = inode->inode_blocks[block_idx]; }
+    if (block_end_idx > 12)
+    {
+        ASSERT(inode->inode_blocks[12] != 0);
+        ide_read(current_part->my_disk, inode->inode_blocks[12], all_blocks + 12, 1);
+    }
+
+    const unsigned char* src = buf;
+    unsigned int bytes_written = 0, sec_lba, sec_off_bytes, chunk_size;
+    while (bytes_written < count)
+    {
+        sec_lba = all_blocks[pos / BLOCK_SIZE];
+        sec_off_bytes = pos % BLOCK_SIZE;
+        chunk_size = BLOCK_SIZE - sec_off_bytes;
+        if (chunk_size > count - bytes_written)
+        { chunk_size = count - bytes_written; }
+
+        if (chunk_size == BLOCK_SIZE)   // 整个扇区都要改写, 直接从buf写入, 不必经过io_buf
+        { ide_write(current_part->my_disk, sec_lba, (void*)src, 1); }
+        else    // 只改写扇区的一部分, 要先读出扇区中原有的数据
+        {
+            ide_read(current_part->my_disk, sec_lba, io_buf, 1);
+            memcpy(io_buf + sec_off_bytes, src, chunk_size);
+            ide_write(current_part->my_disk, sec_lba, io_buf, 1);
+        }
+
+        src += chunk_size;
+        pos += chunk_size;
+        bytes_written += chunk_size;
+    }
+
+    kmem_cache_free(&all_blocks_cache, all_blocks);
+    kmem_cache_free(&io_buf_cache, io_buf);
+    return bytes_written;
+}
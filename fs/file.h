@@ -2,6 +2,7 @@
 #define __FS_FILE_H
 
 #include "dir.h"        // struct dir
+#include "slab.h"       // struct kmem_cache
 
 /* 文件结构 */
 // 本项目中的管道实现复用了此结构: 若是管道, fd_flag 为 0xFFFF, fd_inode 指向管道的内存缓冲区, fd_pos管道的打开数
@@ -64,6 +65,18 @@ signed int file_write(struct file* file, const void* buf, unsigned int count);
 /* 从文件file中读取count个字节写入buf, 返回读出的字节数,若到文件尾则返回-1 */
 signed int file_read(struct file* file, void* buf, unsigned int count);
 
+/* 改写文件inode中从pos开始的count个字节, 不改变文件大小 */
+signed int file_overwrite(struct inode *inode, unsigned int pos, const void *buf, unsigned int count);
+
+
+/* 文件读写用的缓冲区缓存: 1扇区和2扇区的io缓冲区, 及收集全部块地址的all_blocks数组 */
+// 12个直接块 + 128个一级间接块, 共560字节
+#define ALL_BLOCKS_SIZE     (48 + 512)
+extern struct kmem_cache io_buf_cache, io_buf2_cache, all_blocks_cache;
+
+/* 创建文件读写用的缓冲区缓存 */
+void file_cache_init(void);
+
 
 /* 分配一个i结点, 返回i结点号 */
 signed int inode_bitmap_alloc(struct partition *part);
@@ -16,6 +16,8 @@
 #include "debug.h"      // PANIC
 
 #include "pipe.h"       // is_pipe
+#include "swap.h"       // is_swap_partition
+#include "image_cache.h"    // image_cache_invalidate
 
 
 // 默认情况下操作的是哪个分区
@@ -196,6 +198,11 @@ void filesys_init()
     }
     printk("searching file system...\n");
     
+    // 创建文件系统常用对象的slab缓存
+    inode_cache_init();
+    dir_cache_init();
+    file_cache_init();
+    
     // 在分区上扫描文件系统, 我们这里只支持partition_format创建的文件系统, 魔数为 0x19590318
     // 三层循环: 最外层循环, 遍历通道  中间层, 遍历通道中的硬盘  最内层, 遍历硬盘上的所有分区
     while(channel_id < channel_count)
@@ -223,7 +230,12 @@ void filesys_init()
                  * partition又为disk的嵌套结构,因此partition中的成员默认也为0.
                  * 若partition未初始化,则partition中的成员仍为0. 
                  * 下面处理存在的分区. */                
-                if(part->sector_count != 0)     // 如果分区存在
+                // 交换分区中存放的是换出的页, 不建文件系统
+                if(part->sector_count != 0 && is_swap_partition(part->name))
+                {
+                    printk("%s is reserved for swap\n", part->name);
+                }
+                else if(part->sector_count != 0)     // 如果分区存在
                 {
                     memset(sbk_buf, 0, SECTOR_SIZE);
                     
@@ -309,8 +321,15 @@ static bool mount_partition(struct list_elem *part_elem, int arg)
             PANIC("ERROR: allocate memory failed!");
         }
         current_part->block_bitmap.bitmap_bytes_len = sbk_buf->block_bitmap_sectors * SECTOR_SIZE;
-        // 从硬盘上读入块位图到分区的block_bitmap.bits
+        current_part->block_bitmap.summary = \
+            (unsigned int *)sys_malloc(BITMAP_SUMMARY_BYTES(current_part->block_bitmap.bitmap_bytes_len));
+        if(current_part->block_bitmap.summary == NULL)
+        {
+            PANIC("ERROR: allocate memory failed!");
+        }
+        // 从硬盘上读入块位图到分区的block_bitmap.bits, 再据此建立摘要位图
         ide_read(hd, sbk_buf->block_bitmap_lba, current_part->block_bitmap.bits, sbk_buf->block_bitmap_sectors);
+        bitmap_refresh(&current_part->block_bitmap);
         /*************************************************************/
 
         /**********     将硬盘上的inode位图读入到内存    ************/ 
@@ -320,8 +339,15 @@ static bool mount_partition(struct list_elem *part_elem, int arg)
             PANIC("ERROR: allocate memory failed!");
         }
         current_part->inode_bitmap.bitmap_bytes_len = sbk_buf->inode_bitmap_sectors * SECTOR_SIZE;
-        // 从硬盘上读入inode位图到分区的inode_bitmap.bits
+        current_part->inode_bitmap.summary = \
+            (unsigned int *)sys_malloc(BITMAP_SUMMARY_BYTES(current_part->inode_bitmap.bitmap_bytes_len));
+        if(current_part->inode_bitmap.summary == NULL)
+        {
+            PANIC("ERROR: allocate memory failed!");
+        }
+        // 从硬盘上读入inode位图到分区的inode_bitmap.bits, 再据此建立摘要位图
         ide_read(hd, sbk_buf->inode_bitmap_lba, current_part->inode_bitmap.bits, sbk_buf->inode_bitmap_sectors);
+        bitmap_refresh(&current_part->inode_bitmap);
         /*************************************************************/
         
         // 本分区打开的i结点队列
@@ -764,8 +790,18 @@ signed int sys_unlink(const char* pathname)
     }
     ASSERT(file_idx == MAX_FILE_OPEN);
 
+    /* 文件的描述符关闭后, 进程映射的文件区域和正在运行的程序仍持有inode,
+     * 映像缓存中的页也持有inode, 先丢弃这些页, 之后inode仍打开着就说明文件还在用 */
+    image_cache_invalidate(inode_no);
+    if (inode_is_open(current_part, inode_no))
+    {
+        dir_close(searched_record.parent_dir);
+        printk("file %s is mapped or running, not allow to delete!\n", pathname);
+        return -1;
+    }
+
     /* 为delete_dir_entry申请缓冲区 */
-    void* io_buf = sys_malloc(SECTOR_SIZE + SECTOR_SIZE);
+    void* io_buf = kmem_cache_alloc(&io_buf2_cache);
     if (io_buf == NULL)
     {
         dir_close(searched_record.parent_dir);
@@ -776,7 +812,7 @@ signed int sys_unlink(const char* pathname)
     struct dir* parent_dir = searched_record.parent_dir;
     delete_dir_entry(current_part, parent_dir, inode_no, io_buf);   // 删除目录项
     inode_release(current_part, inode_no);                          // 释放inode
-    sys_free(io_buf);
+    kmem_cache_free(&io_buf2_cache, io_buf);
     dir_close(searched_record.parent_dir);  // 关闭pathname所在的目录后
     return 0;   // 成功删除文件 
 }
@@ -791,10 +827,10 @@ signed int sys_unlink(const char* pathname)
 signed int sys_mkdir(const char* pathname)
 {
     unsigned char rollback_step = 0;	       // 用于操作失败时回滚各资源状态
-    void* io_buf = sys_malloc(SECTOR_SIZE * 2);
+    void* io_buf = kmem_cache_alloc(&io_buf2_cache);
     if (io_buf == NULL)
     {
-        printk("sys_mkdir: sys_malloc for io_buf failed\n");
+        printk("sys_mkdir: alloc for io_buf failed\n");
         return -1;
     }
 
@@ -896,7 +932,7 @@ signed int sys_mkdir(const char* pathname)
     /* 将inode位图同步到硬盘 */
     bitmap_sync(current_part, inode_no, INODE_BITMAP);
 
-    sys_free(io_buf);
+    kmem_cache_free(&io_buf2_cache, io_buf);
 
     /* 关闭所创建目录的父目录 */
     dir_close(searched_record.parent_dir);
@@ -912,7 +948,7 @@ rollback:	     // 因为某步骤操作失败而回滚
         dir_close(searched_record.parent_dir);
         break;
     }
-    sys_free(io_buf);
+    kmem_cache_free(&io_buf2_cache, io_buf);
     return -1;
 }
 
@@ -1108,7 +1144,7 @@ char* sys_getcwd(char* buf, unsigned int size)
     /* 确保buf不为空,若用户进程提供的buf为NULL,
     系统调用getcwd中要为用户进程通过malloc分配内存 */
     ASSERT(buf != NULL);
-    void* io_buf = sys_malloc(SECTOR_SIZE);
+    void* io_buf = kmem_cache_alloc(&io_buf_cache);
     if (io_buf == NULL)
     {
         return NULL;
@@ -1123,7 +1159,7 @@ char* sys_getcwd(char* buf, unsigned int size)
     {
         buf[0] = '/';
         buf[1] = 0;
-        sys_free(io_buf);   // DEBUG_2020
+        kmem_cache_free(&io_buf_cache, io_buf);   // DEBUG_2020
         return buf;
     }
 
@@ -1138,7 +1174,7 @@ char* sys_getcwd(char* buf, unsigned int size)
         parent_inode_nr = get_parent_dir_inode_nr(child_inode_nr, io_buf);
         if (get_child_dir_name(parent_inode_nr, child_inode_nr, full_path_reverse, io_buf) == -1)	  // 或未找到名字,失败退出
         {
-            sys_free(io_buf);
+            kmem_cache_free(&io_buf_cache, io_buf);
             return NULL;
         }
         child_inode_nr = parent_inode_nr;
@@ -1156,7 +1192,7 @@ char* sys_getcwd(char* buf, unsigned int size)
         /* 在full_path_reverse中添加结束字符,做为下一次执行strcpy中last_slash的边界 */
         *last_slash = 0;
     }
-    sys_free(io_buf);
+    kmem_cache_free(&io_buf_cache, io_buf);
     return buf;
 }
 
@@ -1250,6 +1286,8 @@ void sys_help(void)
         rm: remove a regular file\n \
         pwd: show current work direcotry\n \
         ps: show process information\n \
+        meminfo: show memory usage\n \
+        heapprof: show top heap allocation sites\n \
         clear: clear screen\n \
     shortcut key:\n \
         ctrl+l: clear screen\n \
@@ -7,6 +7,28 @@
 #include "interrupt.h"  // enum intr_status
 
 #include "debug.h"
+#include "slab.h"       // kmem_cache_alloc
+
+struct kmem_cache inode_cache;  // 内存中inode对象的缓存
+
+
+/* inode对象的构造函数 */
+// 回到缓存中的inode打开数必为0, 且不处于任何open_inodes链表中
+static void inode_ctor(void *obj)
+{
+    struct inode *inode = obj;
+    inode->inode_open_count = 0;
+    inode->write_deny = false;
+    inode->inode_tag.prev = inode->inode_tag.next = NULL;
+}
+
+
+/* 创建inode对象缓存 */
+void inode_cache_init(void)
+{
+    kmem_cache_init(&inode_cache, "inode", sizeof(struct inode), inode_ctor);
+}
+
 
 /* 存储inode位置 */
 // inode所在的扇区地址及在扇区内的偏移量, 用于定位inode在磁盘上的位置
@@ -125,26 +147,20 @@ struct inode *inode_open(struct partition *part, unsigned int inode_id)
     // inode位置信息会存入inode_pos, 包括inode所在扇区地址和扇区内的字节偏移量
     inode_locate(part, inode_id, &inode_pos);
     
-    /* 为使通过sys_malloc创建的新inode被所有任务共享, 需要将inode置于内核空间
-     * 故需要临时将current_pbc->pgdir置为NULL */
-    struct task_struct *current = running_thread();
-    unsigned int *current_pagedir_bak = current->pgdir;
-    current->pgdir = NULL;
-    // 此时分配的内存将位于内核区
-    inode_found = (struct inode *)sys_malloc(sizeof(struct inode));
-    // 恢复pgdir
-    current->pgdir = current_pagedir_bak;
+    /* inode要被所有任务共享, 需要置于内核空间.
+     * slab缓存总是从内核内存池分配, 不必再临时将current_pbc->pgdir置为NULL */
+    inode_found = (struct inode *)kmem_cache_alloc(&inode_cache);
     
     char *inode_buf;
     if(inode_pos.two_sector)    // 考虑跨扇区的情况
     {
-        inode_buf = (char *)sys_malloc(1024);
+        inode_buf = (char *)kmem_cache_alloc(&io_buf2_cache);
         // i结点表时被partition_format函数连续写入扇区的, 所以可以连续读出来
         ide_read(part->my_disk, inode_pos.sector_lba, inode_buf, 2);
     }
     else    // 否则, 所查找的inode未跨扇区, 一个扇区大小的缓冲区足够
     {
-        inode_buf = (char *)sys_malloc(512);
+        inode_buf = (char *)kmem_cache_alloc(&io_buf_cache);
         ide_read(part->my_disk, inode_pos.sector_lba, inode_buf, 1);
     }
     memcpy(inode_found, inode_buf + inode_pos.offset_size, sizeof(struct inode));
@@ -153,11 +169,28 @@ struct inode *inode_open(struct partition *part, unsigned int inode_id)
     list_push(&part->open_inodes, &inode_found->inode_tag);
     inode_found->inode_open_count = 1;
     
-    sys_free(inode_buf);
+    if(inode_pos.two_sector)
+        kmem_cache_free(&io_buf2_cache, inode_buf);
+    else
+        kmem_cache_free(&io_buf_cache, inode_buf);
     return inode_found;
 }
 
 
+/* inode_id号inode是否仍被打开着, 如被某进程映射着的文件、正在运行的程序 */
+bool inode_is_open(struct partition *part, unsigned int inode_id)
+{
+    struct list_elem *elem = part->open_inodes.head.next;
+    while(elem != &part->open_inodes.tail)
+    {
+        if((elem2entry(struct inode, inode_tag, elem))->inode_id == inode_id)
+            return true;
+        elem = elem->next;
+    }
+    return false;
+}
+
+
 /* 关闭inode或减少inode的打开数 */
 void inode_close(struct inode *inode)
 {
@@ -167,14 +200,8 @@ void inode_close(struct inode *inode)
     if(--inode->inode_open_count == 0)
     {
         list_remove(&inode->inode_tag);     // 将i结点从part->open_inodes中去掉
-        // inode_open时为实现inode被所有进程共享, 已经在sys_malloc为inode分配了内核空间
-        // 释放inode时也要确保释放的是内核内存池
-        struct task_struct *current = running_thread();
-        unsigned int *current_pagedir_bak = current->pgdir;
-        current->pgdir = NULL;
-        sys_free(inode);    // 这样释放的便是内核空间内存
-        
-        current->pgdir = current_pagedir_bak;
+        // inode_open时为实现inode被所有进程共享, inode分配自内核空间的slab缓存
+        kmem_cache_free(&inode_cache, inode);
     }
     intr_set_status(old_status);
 }
@@ -308,11 +335,11 @@ void inode_release(struct partition* part, unsigned int inode_no)
     * 此函数会在inode_table中将此inode清0,
     * 但实际上是不需要的,inode分配是由inode位图控制的,
     * 硬盘上的数据不需要清0,可以直接覆盖*/
-    void* io_buf = sys_malloc(1024);
+    void* io_buf = kmem_cache_alloc(&io_buf2_cache);
     
     inode_delete(part, inode_no, io_buf);
     
-    sys_free(io_buf);
+    kmem_cache_free(&io_buf2_cache, io_buf);
     /***********************************************/
 
     inode_close(inode_to_del);
@@ -4,6 +4,7 @@
 #include "global.h"     // bool
 #include "list.h"       // struct list_elem
 #include "ide.h"        // struct partition
+#include "slab.h"       // struct kmem_cache
 
 /* inode结构 */
 struct inode{
@@ -31,12 +32,20 @@ struct inode{
 
 
 
+extern struct kmem_cache inode_cache;  // 内存中inode对象的缓存
+
+/* 创建inode对象缓存 */
+void inode_cache_init(void);
+
 /* 根据i结点号返回相应的i结点 */
 // inode是存储在磁盘上, 为减少频繁访问磁盘, 在内存中为各分区创建了inode队列, 即 part->open_inodes
 // open_inodes为已打开的inode队列, 是inode的缓存, 以后每打开一个inode, 先在此缓存中查找
 // 若未找到, 再从磁盘上加载该inode到此缓存中
 struct inode *inode_open(struct partition *part, unsigned int inode_id);
 
+/* inode_id号inode是否仍被打开着 */
+bool inode_is_open(struct partition *part, unsigned int inode_id);
+
 /* 关闭inode或减少inode的打开数 */
 void inode_close(struct inode *inode);
 
@@ -0,0 +1,67 @@
+#!/bin/bash
+
+# 把shell的heapprof命令输出中的调用点地址换成 函数名+偏移 (所在目标文件)
+# 用法: ./heap_symbolize.sh < heapprof输出     或     ./heap_symbolize.sh 0xc0004a1b ...
+# 符号取自链接时生成的build/kernel.map, 其中只有全局符号,
+# 调用点在static函数中时会显示为它前面最近的全局函数加上较大的偏移, 看目标文件名即可定位到源文件
+
+MAP="build/kernel.map"
+
+if [ ! -f $MAP ]
+then
+    echo "## ERROR: $MAP is required, run make first !!! ##"
+    exit 1
+fi
+
+if [ $# -gt 0 ]
+then
+    INPUT=$(printf "%s\n" "$@")
+else
+    INPUT=$(cat)
+fi
+
+echo "$INPUT" | awk -v map=$MAP '
+    # 十六进制串转数值, 不依赖gawk的strtonum
+    function hex(str,    val, i)
+    {
+        val = 0
+        str = tolower(substr(str, 3))
+        for(i = 1; i <= length(str); i++)
+            val = val * 16 + index("0123456789abcdef", substr(str, i, 1)) - 1
+        return val
+    }
+    # kernel.map中 .text段的每个输入段一行: " .text  地址  大小  目标文件", 其后各行: "  地址  符号名"
+    BEGIN {
+        count = 0
+        while((getline line < map) > 0)
+        {
+            n = split(line, f, " ")
+            if(f[1] == ".text" && n == 4)
+                obj = f[4]
+            else if(f[1] ~ /^\./)
+                obj = ""
+            else if(obj != "" && n == 2 && f[1] ~ /^0x/)
+            {
+                addr[count] = hex(f[1])
+                name[count] = f[2]
+                file[count] = obj
+                count++
+            }
+        }
+    }
+    {
+        out = $0
+        for(i = 1; i <= NF; i++)
+        {
+            if($i !~ /^0x[0-9a-fA-F]+$/)
+                continue
+            target = hex($i)
+            best = -1
+            for(j = 0; j < count; j++)
+                if(addr[j] <= target && (best == -1 || addr[j] > addr[best]))
+                    best = j
+            if(best != -1)
+                out = out sprintf("  %s+0x%x (%s)", name[best], target - addr[best], file[best])
+        }
+        print out
+    }'
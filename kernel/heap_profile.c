@@ -0,0 +1,278 @@
+#include "heap_profile.h"
+#include "global.h"         // NULL PAGE_SIZE
+
+#ifdef HEAP_PROFILE
+
+#include "memory.h"         // get_kernel_pages
+#include "thread.h"         // running_thread
+#include "timer.h"          // ticks IRQ0_FREQUENCY
+#include "interrupt.h"
+#include "string.h"         // memset memcpy
+#include "stdio_kernel.h"   // printk
+#include "debug.h"
+
+#define SITE_COUNT      256     // 调用点表的容量
+#define LIVE_SLOTS      4096    // 尚未释放的内存的记录表容量, 须为2的幂
+
+/* 调用点 */
+struct heap_site{
+    void *caller;
+    unsigned int allocs;
+    unsigned int frees;
+    unsigned int total_bytes;
+    unsigned int live_bytes;
+    unsigned int peak_bytes;
+    unsigned int lifetime_ticks;    // 已释放的内存块存活的嘀嗒数之和
+};
+
+/* 一块尚未释放的内存, 释放时凭它找回申请时的调用点和大小 */
+// 各进程的堆地址会重叠, 以所属页目录区分, 内核堆为NULL
+struct heap_live{
+    void *vaddr;                // 为NULL表示空槽
+    unsigned int *pgdir;
+    unsigned int size;
+    unsigned int site;          // 调用点在sites中的下标
+    unsigned int alloc_tick;    // 申请时的嘀嗒数
+};
+
+static struct heap_site *sites;
+static unsigned int site_count;
+static struct heap_live *lives;     // 开放定址的散列表, 冲突时顺序往后找
+static unsigned int start_ticks;    // 开始剖析时的嘀嗒数, 用来算申请速率
+static bool full_warned;            // 表满时只告警一次
+
+
+/* 分配调用点表和记录表, 须在内存管理初始化之后 */
+void heap_profile_init(void)
+{
+    sites = get_kernel_pages(DIV_ROUND_UP(SITE_COUNT * sizeof(struct heap_site), PAGE_SIZE));
+    lives = get_kernel_pages(DIV_ROUND_UP(LIVE_SLOTS * sizeof(struct heap_live), PAGE_SIZE));
+    ASSERT(sites != NULL && lives != NULL);
+    start_ticks = ticks;
+}
+
+
+/* 地址为vaddr、属于页目录pgdir的内存块在记录表中的起始槽 */
+static unsigned int live_hash(void *vaddr, unsigned int *pgdir)
+{
+    return (((unsigned int)vaddr >> 4) ^ ((unsigned int)pgdir >> 12)) & (LIVE_SLOTS - 1);
+}
+
+
+/* 找调用点caller在sites中的下标, 没有则新建, 表满返回-1 */
+static signed int site_get(void *caller)
+{
+    unsigned int idx;
+    for(idx = 0; idx < site_count; idx++)
+    {
+        if(sites[idx].caller == caller)
+            return idx;
+    }
+    if(site_count == SITE_COUNT)
+        return -1;
+    
+    memset(&sites[site_count], 0, sizeof(struct heap_site));
+    sites[site_count].caller = caller;
+    return site_count++;
+}
+
+
+/* 表满时告警一次, 之后的申请不再记录, 统计会偏少 */
+static void heap_profile_full(const char *table)
+{
+    if(!full_warned)
+    {
+        full_warned = true;
+        printk("heap profile: %s table full, later allocations are not recorded\n", table);
+    }
+}
+
+
+/* 记录调用点caller申请到了vaddr处size字节的内存 */
+void heap_profile_alloc(void *caller, void *vaddr, unsigned int size)
+{
+    if(sites == NULL)   // 剖析开始前的申请不记录, 它们的释放也找不到记录, 会被忽略
+        return;
+    unsigned int *pgdir = running_thread()->pgdir;
+    
+    enum intr_status old_status = intr_disable();
+    signed int site = site_get(caller);
+    if(site == -1)
+    {
+        heap_profile_full("site");
+        intr_set_status(old_status);
+        return;
+    }
+    
+    unsigned int slot = live_hash(vaddr, pgdir);
+    unsigned int probe;
+    for(probe = 0; probe < LIVE_SLOTS && lives[slot].vaddr != NULL; probe++)
+        slot = (slot + 1) & (LIVE_SLOTS - 1);
+    if(probe == LIVE_SLOTS)
+    {
+        heap_profile_full("live");
+        intr_set_status(old_status);
+        return;
+    }
+    lives[slot].vaddr = vaddr;
+    lives[slot].pgdir = pgdir;
+    lives[slot].size = size;
+    lives[slot].site = site;
+    lives[slot].alloc_tick = ticks;
+    
+    struct heap_site *hs = &sites[site];
+    hs->allocs++;
+    hs->total_bytes += size;
+    hs->live_bytes += size;
+    if(hs->live_bytes > hs->peak_bytes)
+        hs->peak_bytes = hs->live_bytes;
+    intr_set_status(old_status);
+}
+
+
+/* 从记录表中删掉slot处的记录
+ * 把其后同一串中的记录往前挪, 保证查找时顺序往后找不会被空槽截断 */
+static void live_remove(unsigned int slot)
+{
+    unsigned int next = slot;
+    while(1)
+    {
+        next = (next + 1) & (LIVE_SLOTS - 1);
+        if(lives[next].vaddr == NULL)
+            break;
+        // 记录的起始槽若循环地落在(slot, next]内, 它不能挪到slot
+        unsigned int home = live_hash(lives[next].vaddr, lives[next].pgdir);
+        if(((next - home) & (LIVE_SLOTS - 1)) < ((next - slot) & (LIVE_SLOTS - 1)))
+            continue;
+        lives[slot] = lives[next];
+        slot = next;
+    }
+    lives[slot].vaddr = NULL;
+}
+
+
+/* 释放地址为vaddr、属于页目录pgdir的内存块, 记到申请它的调用点上 */
+static void live_free(void *vaddr, unsigned int *pgdir)
+{
+    unsigned int slot = live_hash(vaddr, pgdir);
+    unsigned int probe;
+    for(probe = 0; probe < LIVE_SLOTS && lives[slot].vaddr != NULL; probe++)
+    {
+        if(lives[slot].vaddr == vaddr && lives[slot].pgdir == pgdir)
+        {
+            struct heap_site *hs = &sites[lives[slot].site];
+            hs->frees++;
+            hs->live_bytes -= lives[slot].size;
+            hs->lifetime_ticks += ticks - lives[slot].alloc_tick;
+            live_remove(slot);
+            return;
+        }
+        slot = (slot + 1) & (LIVE_SLOTS - 1);
+    }
+}
+
+
+/* 记录当前任务释放了vaddr处的内存 */
+void heap_profile_free(void *vaddr)
+{
+    if(sites == NULL)
+        return;
+    unsigned int *pgdir = running_thread()->pgdir;
+    
+    enum intr_status old_status = intr_disable();
+    live_free(vaddr, pgdir);
+    intr_set_status(old_status);
+}
+
+
+/* 当前进程的用户空间将整个释放, 其堆中未释放的内存都算作释放 */
+void heap_profile_release(void)
+{
+    if(sites == NULL)
+        return;
+    unsigned int *pgdir = running_thread()->pgdir;
+    
+    enum intr_status old_status = intr_disable();
+    unsigned int slot = 0;
+    while(slot < LIVE_SLOTS)
+    {
+        // 删除时后面的记录可能挪到slot, 所以删除后要重新检查slot
+        if(lives[slot].vaddr != NULL && lives[slot].pgdir == pgdir)
+            live_free(lives[slot].vaddr, pgdir);
+        else
+            slot++;
+    }
+    intr_set_status(old_status);
+}
+
+
+/* 按申请次数取前count个调用点存入info, 返回取到的个数
+ * 频繁申请又很快释放的调用点尚未释放的字节数很少, 所以按申请次数排 */
+signed int sys_heapprof(struct heap_site_info *info, unsigned int count)
+{
+    if(count > HEAP_PROFILE_TOP)
+        count = HEAP_PROFILE_TOP;
+    
+    // 先在内核栈上挑选, 开中断后再复制给调用者, 免得关中断期间写用户缓冲区引起缺页
+    struct heap_site_info top[HEAP_PROFILE_TOP];
+    unsigned char rank[SITE_COUNT];     // 调用点选入top中的下标加1, 为0表示未选入
+    memset(rank, 0, sizeof(rank));
+    
+    enum intr_status old_status = intr_disable();
+    unsigned int elapsed = ticks - start_ticks;
+    if(elapsed == 0)
+        elapsed = 1;
+    
+    unsigned int top_count, idx;
+    for(top_count = 0; top_count < count && top_count < site_count; top_count++)
+    {
+        signed int best = -1;
+        for(idx = 0; idx < site_count; idx++)
+        {
+            if(!rank[idx] && (best == -1 || sites[idx].allocs > sites[best].allocs))
+                best = idx;
+        }
+        rank[best] = top_count + 1;
+    
+        struct heap_site *hs = &sites[best];
+        top[top_count].caller = hs->caller;
+        top[top_count].allocs = hs->allocs;
+        top[top_count].frees = hs->frees;
+        top[top_count].total_bytes = hs->total_bytes;
+        top[top_count].live_bytes = hs->live_bytes;
+        top[top_count].peak_bytes = hs->peak_bytes;
+        // 先除后乘, 免得申请次数多时溢出
+        top[top_count].allocs_per_sec = hs->allocs / elapsed * IRQ0_FREQUENCY + \
+                                        hs->allocs % elapsed * IRQ0_FREQUENCY / elapsed;
+        top[top_count].avg_lifetime_ms = hs->frees == 0 ? 0 : \
+                                         hs->lifetime_ticks / hs->frees * (1000 / IRQ0_FREQUENCY);
+        top[top_count].oldest_live_ms = 0;
+    }
+    
+    // 扫一遍记录表, 找出选中的调用点尚未释放的内存块中存活最久的, 久未释放的可能是泄漏
+    unsigned int slot;
+    for(slot = 0; slot < LIVE_SLOTS; slot++)
+    {
+        if(lives[slot].vaddr == NULL || !rank[lives[slot].site])
+            continue;
+        unsigned int age_ms = (ticks - lives[slot].alloc_tick) * (1000 / IRQ0_FREQUENCY);
+        struct heap_site_info *info_top = &top[rank[lives[slot].site] - 1];
+        if(age_ms > info_top->oldest_live_ms)
+            info_top->oldest_live_ms = age_ms;
+    }
+    intr_set_status(old_status);
+    
+    memcpy(info, top, top_count * sizeof(struct heap_site_info));
+    return top_count;
+}
+
+#else
+
+/* 未编入堆分配剖析 */
+signed int sys_heapprof(struct heap_site_info *info __attribute__((unused)), \
+                        unsigned int count __attribute__((unused)))
+{
+    return -1;
+}
+
+#endif
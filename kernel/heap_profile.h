@@ -0,0 +1,36 @@
+#ifndef __KERNEL_HEAP_PROFILE_H
+#define __KERNEL_HEAP_PROFILE_H
+
+/* 堆分配剖析: 按调用点统计sys_malloc/sys_free, 找出频繁申请释放堆内存的内核路径
+ * 编译时定义HEAP_PROFILE才启用, 否则下面的记录函数都是空操作, sys_heapprof返回-1 */
+
+#define HEAP_PROFILE_TOP    16  // heapprof系统调用最多返回的调用点数
+
+/* 一个调用点的统计, 调用点即调用sys_malloc处的返回地址, 可对照build/kernel.map找到所在函数 */
+struct heap_site_info{
+    void *caller;               // 调用点
+    unsigned int allocs;        // 申请次数
+    unsigned int frees;         // 释放次数, 含在别处释放的此处申请的内存
+    unsigned int total_bytes;   // 累计申请的字节数
+    unsigned int live_bytes;    // 尚未释放的字节数
+    unsigned int peak_bytes;    // live_bytes的峰值
+    unsigned int allocs_per_sec;    // 开始剖析以来平均每秒的申请次数
+    unsigned int avg_lifetime_ms;   // 已释放的内存块从申请到释放平均经过的毫秒数
+    unsigned int oldest_live_ms;    // 尚未释放的内存块中最早申请的已存活的毫秒数, 没有则为0
+};
+
+#ifdef HEAP_PROFILE
+void heap_profile_init(void);
+void heap_profile_alloc(void *caller, void *vaddr, unsigned int size);
+void heap_profile_free(void *vaddr);
+void heap_profile_release(void);
+#else
+#define heap_profile_init()                     ((void)0)
+#define heap_profile_alloc(caller, vaddr, size) ((void)0)
+#define heap_profile_free(vaddr)                ((void)0)
+#define heap_profile_release()                  ((void)0)
+#endif
+
+signed int sys_heapprof(struct heap_site_info *info, unsigned int count);
+
+#endif
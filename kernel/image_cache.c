@@ -0,0 +1,200 @@
+#include "image_cache.h"
+#include "memory.h"     // user_frame_get free_a_phy_page page_ref_count
+#include "inode.h"      // struct inode inode_close
+#include "slab.h"
+#include "interrupt.h"
+#include "debug.h"
+
+#define IMAGE_CACHE_BUCKETS 64  // 散列表的桶数
+
+/* 缓存的一页 */
+struct image_page{
+    struct list_elem hash_tag;  // 用于挂到所在的散列桶中
+    struct list_elem lru_tag;   // 用于挂到lru_list中
+    struct inode *inode;        // 持有inode的一次打开计数, 免得inode被释放后编号被别的文件重用
+    unsigned int pos;           // 页起始处对应的文件偏移, 段从页中间开始时是页前面某处的偏移
+    unsigned int begin;         // 页内来自文件的部分[begin, end)
+    unsigned int end;
+    unsigned int page_phyaddr;  // 页框, 缓存持有其一次引用
+};
+
+static struct kmem_cache image_page_cache;  // struct image_page 对象缓存
+static struct list buckets[IMAGE_CACHE_BUCKETS];
+static struct list lru_list;    // 最近用到的页在队首, 回收时从队尾找
+
+
+/* 初始化映像缓存 */
+void image_cache_init(void)
+{
+    kmem_cache_init(&image_page_cache, "image_page", sizeof(struct image_page), NULL);
+    unsigned int bucket;
+    for(bucket = 0; bucket < IMAGE_CACHE_BUCKETS; bucket++)
+        list_init(&buckets[bucket]);
+    list_init(&lru_list);
+}
+
+
+/* 页所在的散列桶 */
+static struct list *image_bucket(struct inode *inode, unsigned int pos)
+{
+    return &buckets[(((unsigned int)inode >> 4) ^ (pos >> 12)) % IMAGE_CACHE_BUCKETS];
+}
+
+
+/* 在缓存中找内容相同的页, 调用者需关中断 */
+static struct image_page *image_page_find(struct inode *inode, unsigned int pos, unsigned int begin, unsigned int end)
+{
+    struct list *bucket = image_bucket(inode, pos);
+    struct list_elem *elem = bucket->head.next;
+    while(elem != &bucket->tail)
+    {
+        struct image_page *ip = elem2entry(struct image_page, hash_tag, elem);
+        if(ip->inode == inode && ip->pos == pos && ip->begin == begin && ip->end == end)
+            return ip;
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+
+/* 取缓存中的页, 找到则把页框的引用计数加1后返回其物理地址, 用完后由调用者用free_a_phy_page归还
+ * 加上这次引用之后, 即使该页随后被回收, 页框也不会被释放. 找不到返回0 */
+unsigned int image_cache_get(struct inode *inode, unsigned int pos, unsigned int begin, unsigned int end)
+{
+    enum intr_status old_status = intr_disable();
+    struct image_page *ip = image_page_find(inode, pos, begin, end);
+    unsigned int page_phyaddr = 0;
+    if(ip != NULL)
+    {
+        list_remove(&ip->lru_tag);
+        list_push(&lru_list, &ip->lru_tag);
+        page_phyaddr = ip->page_phyaddr;
+        user_frame_get(page_phyaddr);
+    }
+    intr_set_status(old_status);
+    return page_phyaddr;
+}
+
+
+/* 把刚从文件读入的只读页框page_phyaddr加入缓存, 缓存持有页框和inode各一次引用
+ * 别的进程同时读入了同一页时不再重复加入. 内存不足时不缓存 */
+void image_cache_add(struct inode *inode, unsigned int pos, unsigned int begin, unsigned int end, \
+                     unsigned int page_phyaddr)
+{
+    struct image_page *ip = kmem_cache_alloc(&image_page_cache);
+    if(ip == NULL)
+        return;
+    
+    enum intr_status old_status = intr_disable();
+    if(image_page_find(inode, pos, begin, end) != NULL)
+    {
+        intr_set_status(old_status);
+        kmem_cache_free(&image_page_cache, ip);
+        return;
+    }
+    ip->inode = inode;
+    ip->pos = pos;
+    ip->begin = begin;
+    ip->end = end;
+    ip->page_phyaddr = page_phyaddr;
+    inode->inode_open_count++;
+    user_frame_get(page_phyaddr);
+    list_push(image_bucket(inode, pos), &ip->hash_tag);
+    list_push(&lru_list, &ip->lru_tag);
+    intr_set_status(old_status);
+}
+
+
+/* 从缓存中去掉页ip, 归还缓存持有的页框和inode引用. ip须已摘离缓存的链表 */
+static void image_page_release(struct image_page *ip)
+{
+    free_a_phy_page(ip->page_phyaddr);
+    inode_close(ip->inode);
+    kmem_cache_free(&image_page_cache, ip);
+}
+
+
+/* 文件内容将被改动或文件将被删除, 去掉编号为inode_id的文件的所有缓存页
+ * 已映射这些页框的进程继续使用原来的内容, 之后缺页时再读入新内容 */
+// 缓存不区分分区, 别的分区中同编号文件的页也会被去掉, 只是下次要重新读
+void image_cache_invalidate(unsigned int inode_id)
+{
+    while(1)
+    {
+        enum intr_status old_status = intr_disable();
+        struct image_page *ip = NULL;
+        struct list_elem *elem = lru_list.head.next;
+        while(elem != &lru_list.tail)
+        {
+            struct image_page *cur = elem2entry(struct image_page, lru_tag, elem);
+            if(cur->inode->inode_id == inode_id)
+            {
+                ip = cur;
+                list_remove(&ip->hash_tag);
+                list_remove(&ip->lru_tag);
+                break;
+            }
+            elem = elem->next;
+        }
+        intr_set_status(old_status);
+    
+        if(ip == NULL)
+            return;
+        image_page_release(ip);
+    }
+}
+
+
+/* 用户内存池不够时, 从最久没用到的页起找一页已没有进程在用的页释放
+ * 释放了一页框返回true */
+bool image_cache_reclaim(void)
+{
+    enum intr_status old_status = intr_disable();
+    struct image_page *ip = NULL;
+    struct list_elem *elem = lru_list.tail.prev;
+    while(elem != &lru_list.head)
+    {
+        struct image_page *cur = elem2entry(struct image_page, lru_tag, elem);
+        if(page_ref_count(cur->page_phyaddr) == 1)
+        {
+            ip = cur;
+            list_remove(&ip->hash_tag);
+            list_remove(&ip->lru_tag);
+            break;
+        }
+        elem = elem->prev;
+    }
+    intr_set_status(old_status);
+    
+    if(ip == NULL)
+        return false;
+    image_page_release(ip);
+    return true;
+}
+
+
+/* 内核内存池不够时, 一次释放最多count页已没有进程在用的页, 返回释放的页数 */
+unsigned int image_cache_shrink(unsigned int count)
+{
+    unsigned int freed = 0;
+    while(freed < count && image_cache_reclaim())
+        freed++;
+    return freed;
+}
+
+
+/* 返回缓存中已没有进程在用、可以随时释放的页数 */
+unsigned int image_cache_reclaimable(void)
+{
+    enum intr_status old_status = intr_disable();
+    unsigned int count = 0;
+    struct list_elem *elem = lru_list.head.next;
+    while(elem != &lru_list.tail)
+    {
+        if(page_ref_count((elem2entry(struct image_page, lru_tag, elem))->page_phyaddr) == 1)
+            count++;
+        elem = elem->next;
+    }
+    intr_set_status(old_status);
+    return count;
+}
@@ -0,0 +1,21 @@
+#ifndef __KERNEL_IMAGE_CACHE_H
+#define __KERNEL_IMAGE_CACHE_H
+
+#include "global.h"     // bool
+
+struct inode;
+
+/* 程序映像缓存: 进程不再使用后仍保留从文件读入的只读页, 如程序的代码段
+ * 运行同一程序的进程缺页时直接映射缓存中的页框, 不必再读文件也不必各占一份
+ * 页的内容由文件inode中从pos开始的部分放在页内[begin, end)处决定, 其余部分为0 */
+
+void image_cache_init(void);
+unsigned int image_cache_get(struct inode *inode, unsigned int pos, unsigned int begin, unsigned int end);
+void image_cache_add(struct inode *inode, unsigned int pos, unsigned int begin, unsigned int end, \
+                     unsigned int page_phyaddr);
+void image_cache_invalidate(unsigned int inode_id);
+bool image_cache_reclaim(void);
+unsigned int image_cache_shrink(unsigned int count);
+unsigned int image_cache_reclaimable(void);
+
+#endif
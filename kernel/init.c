@@ -11,6 +11,9 @@
 #include "syscall-init.h"
 #include "ide.h"
 #include "fs.h"
+#include "shm.h"
+#include "swap.h"
+#include "heap_profile.h"
 
 /* 初始化所有模块 */
 void init_all()
@@ -23,6 +26,8 @@ void init_all()
 
     thread_init();  // 初始化线程相关结构
     
+    heap_profile_init();    // 编入堆分配剖析时, 分配其记录表
+    
     timer_init();   // 初始化PIT, 可编程定时计时器Programmable Interval Timer
     
     console_init(); // 初始化控制台
@@ -32,6 +37,8 @@ void init_all()
     tss_init();     // 初始化TSS(任务状态段)
     
     syscall_init(); // 初始化系统调用   
+    
+    shm_init();     // 初始化共享内存段表
 
     intr_enable();  // ide_init 需要打开中断
     
@@ -39,5 +46,7 @@ void init_all()
     // 直到硬盘完成后通过发中断, 由中断处理程序将此信号量sema_up, 唤醒线程
     ide_init();     // 初始化硬盘
     
+    swap_init();    // 查找交换分区, 启用页面交换. 文件系统要跳过交换分区, 故在其之前
+    
     filesys_init(); // 初始化文件系统    
 }
\ No newline at end of file
@@ -121,8 +121,8 @@ static void idt_desc_init(void)
 }
 
 
-/* 通用的中断处理函数 */
-static void general_intr_handler(uint8_t intr_id)
+/* 通用的中断处理函数, 专用的处理程序遇到处理不了的异常时也交给它 */
+void general_intr_handler(uint8_t intr_id)
 {
     // IRQ7和IRQ15会产生伪中断(spurious interrupt)，无需处理
     // 0x2f是从片8259A上的最后一个IRQ引脚，保留项
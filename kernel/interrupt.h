@@ -5,6 +5,7 @@
 
 void idt_init(void);
 void register_handler(unsigned char vector_id, void *function);
+void general_intr_handler(unsigned char intr_id);
 
 
 /*
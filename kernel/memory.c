@@ -5,21 +5,39 @@
 
 #include "sync.h"
 #include "interrupt.h"
+#include "vm_area.h"
+#include "vaddr_region.h"
+#include "thread.h"
+#include "swap.h"
+#include "heap_profile.h"
+#include "image_cache.h"
 
 #define PAGE_SIZE   4096
 
-/***************  位图地址 ********************
- * 因为0xc009f000是内核主线程栈顶，0xc009e000是内核主线程的pcb.
- * 一个页框大小的位图可表示128M内存, 位图位置安排在地址0xc009a000,
- * 这样本系统最大支持4个页框的位图,即512M
- * 0xc009 e00 - 0x4000 = 0xc009 a00 */
-// 一个页框大小的位图，4KB*8bits*4KB=128M
-#define MEM_BITMAP_BASE     0xc009a000      // 内存位图基址
-/*************************************/
-
 /* 0xc000_0000是内核从虚拟地址3G起.
- * 0x0010_0000意指跨过低端1M内存,使虚拟地址在逻辑上连续 */
-#define K_HEAP_START    0xc0100000      // 内核堆空间的起始虚拟地址
+ * 0xc000_0000~0xc03f_ffff归第768个页目录项, 其页表只映射了内核映像所在的低端1MB,
+ * 内核堆从其后的0xc040_0000开始, 由第769个页目录项起的页表逐页映射 */
+#define K_HEAP_START    0xc0400000      // 内核堆空间的起始虚拟地址
+// 内核堆的结束地址(不含), 最后一个页目录项指向页目录表自身, 其余254个页表在loader中已建好
+#define K_HEAP_END      0xffc00000
+#define K_HEAP_PAGES_MAX    ((K_HEAP_END - K_HEAP_START) / PAGE_SIZE)
+
+/* 内存池之间互借页框
+ * 一个内存池的空闲页框用完时, 从另一个内存池借一个空闲块, 每次至少借2^LEND_ORDER页(1MB),
+ * 借出后出借方至少还要剩下LEND_RESERVE_PAGES个空闲页框, 免得把对方也借空 */
+#define LEND_ORDER          8
+#define LEND_RESERVE_PAGES  256
+
+/* cpuid 1号功能返回的edx中的特性位, 及cr4中相应的开关 */
+#define CPUID_PGE   (1 << 13)   // 支持全局页
+#define CR4_PGE     (1 << 7)
+
+// 内核空间的页表项要加上的全局位, CPU不支持全局页时为0
+static unsigned int kernel_pte_global;
+
+/* 一次解除映射的页数超过此值时, 不再逐页invlpg, 而是清空整个TLB
+ * invlpg每条要几十上百个时钟周期, 清空TLB后重新填充的代价与页数无关 */
+#define TLB_FLUSH_THRESHOLD 32
 
 
 /* 二级页表的分页机制下，
@@ -30,39 +48,63 @@
 
 /* 内存池结构
  * 用于管理内存池中的所有物理内存 */
+// 物理页的分配采用伙伴系统(buddy system):
+// 空闲物理页按 2^order 页组成空闲块, 挂在 free_area[order] 链表中,
+// 分配时从最小的够用阶开始取块, 大块对半拆分; 释放时与伙伴块逐级合并
 struct pool{
     struct lock lock;               // 申请内存时互斥, 避免公共资源的竞争
     
-    struct bitmap pool_bitmap;      // 内存池用到的位图结构，用于管理物理内存
-    unsigned int phy_addr_begin;    // 内存池所管理物理内存的起始地址
-    unsigned int pool_size;         // 内存池字节容量，本物理内存池的内存容量
+    struct list free_area[MAX_ORDER];   // 各阶空闲块链表, free_area[k]中的每个空闲块都是2^k页
+    unsigned int phy_addr_begin;    // 内存池初始时所管理物理内存的起始地址
+    unsigned int pool_size;         // 内存池字节容量, 随内存池之间互借页框而变化
+    unsigned int free_pages;        // 内存池中当前空闲的页框数, 含zero_list中的页框
+    
+    struct list zero_list;          // 已预先清0的空闲页框链表, 由idle线程在系统空闲时填充
+    unsigned int zero_pages;        // zero_list中的页框数
 };
 
+#define ZERO_PAGES_MAX  32          // 每个内存池最多预先清0的页框数
+
 struct pool kernel_pool, user_pool;     // 内核内存池和用户内存池
 
+struct page_desc *mem_map;              // 物理页描述符数组, 下标为页框号
+static unsigned int mem_map_count;      // mem_map中描述符的个数, 即物理页框总数
+
 struct virtual_addr kernel_vaddr;       // 用于给内核分配虚拟地址
 
+/* 临时映射窗口kmap: 紧跟在mem_map之后的KMAP_SLOTS个内核虚拟页,
+ * 用于临时映射任意物理页框, 以便访问那些没有映射到内核空间的页框 */
+static unsigned int kmap_vaddr;         // 临时映射窗口的起始虚拟地址
+static unsigned int kmap_depth;         // 已占用的窗口数, 窗口按栈的方式使用
+
+/* 共享零页: 一个内容全0的用户页框, 以只读方式映射给所有尚未写过的匿名页和.bss页
+ * 零页常驻内存, 不参与引用计数, 映射次数也不受ref_count宽度的限制 */
+static unsigned int zero_page_pfn;
+
 
 
 
 /* 内存仓库arena */
-// arena元信息, 12字节
+// arena元信息, 40字节
 // 将会在堆中创建, 给arena结构体指针赋予1个页框以上的内存, arena则成为内存仓库
 // 页框中除了此结构体外的部分都将作为arena的内存池区域, 该区域被平均拆分成多个相同规格的内存块, 即mem_block
-// 这些mem_block会被添加到内存块描述符的free_list
+// 这些mem_block挂在arena自己的free_list中, 有空闲块的arena再挂到内存块描述符的partial_list中
 struct arena{
     struct mem_block_desc *desc;    // 此arena关联的mem_block_desc
     // large为true时, count表示页框数; 否则, count表示空间mem_block数量
     unsigned int count;
     // large表示此arena用于处理大于1024字节以上的内存分配
     bool large;
+    unsigned int desc_index;        // desc在内存块描述符数组中的下标, 即内存块规格
+    struct list free_list;          // 本arena中的空闲内存块链表
+    struct list_elem partial_tag;   // 用于挂到desc->partial_list中
 };
 
 
-
 // 内核内存块描述符数组
 // 用户进程也有自己的内存块描述符数组, 将来定义在PCB中
 struct mem_block_desc k_block_descs[MEM_DESC_COUNT];    
+static struct mem_large_stat k_large_stat;     // 内核堆中的大块内存统计
 
 /* 为malloc准备 */
 void block_desc_init(struct mem_block_desc *desc_array)
@@ -79,7 +121,8 @@ void block_desc_init(struct mem_block_desc *desc_array)
         desc_array[desc_index].blocks_per_arena = (PAGE_SIZE - sizeof(struct arena)) / block_size;
         
         // 每种规格都有一个链表
-        list_init(&desc_array[desc_index].free_list);
+        list_init(&desc_array[desc_index].partial_list);
+        desc_array[desc_index].arena_count = 0;
         
         // 规格: 16 32 64 128 256 512 1024字节
         block_size *= 2;    // 下一种规格的内存块
@@ -89,6 +132,53 @@ void block_desc_init(struct mem_block_desc *desc_array)
 
 
 
+static void page_table_add(void *_vaddr, void *_page_phyaddr);
+static void vaddr_remove(enum pool_flags pf, void *_vaddr, unsigned int page_count);
+static void pfree(unsigned int pg_phy_addr);
+static void tlb_flush_all(void);
+static void tlb_flush_range(unsigned int vaddr, unsigned int page_count);
+static bool pages_map(enum pool_flags pf, void *vaddr_begin, unsigned int page_count, bool zero);
+static void *palloc_zeroed(struct pool *mem_pool, bool *zeroed);
+static void page_fault_handler(unsigned int vec_id);
+static void *palloc_user(bool *zeroed);
+static bool swap_out_page(void);
+static bool user_page_reclaim(void);
+static bool page_swapped(unsigned int vaddr);
+static bool swap_in_page(unsigned int vaddr);
+static void buddy_free(struct pool *mem_pool, unsigned int pfn, unsigned int order);
+
+
+/* 把物理地址[phy_begin, phy_end)内的页框按最大的对齐块交给内存池的伙伴系统 */
+static void buddy_init(struct pool *mem_pool, unsigned int phy_begin, unsigned int phy_end)
+{
+    unsigned int pfn = phy_begin / PAGE_SIZE, pfn_end = phy_end / PAGE_SIZE;
+    unsigned int order;
+    
+    for(order = 0; order < MAX_ORDER; order++)
+        list_init(&mem_pool->free_area[order]);
+    mem_pool->free_pages = 0;
+    list_init(&mem_pool->zero_list);
+    mem_pool->zero_pages = 0;
+    
+    for(; pfn < pfn_end; pfn++)
+    {
+        mem_map[pfn].pool = mem_pool;
+        mem_map[pfn].flags = 0;
+    }
+    
+    // 块的起始页框号须按块大小对齐, 伙伴之间才能通过 pfn ^ (1 << order) 互相找到
+    pfn = phy_begin / PAGE_SIZE;
+    while(pfn < pfn_end)
+    {
+        order = MAX_ORDER - 1;
+        while(order > 0 && ((pfn & ((1u << order) - 1)) != 0 || pfn + (1u << order) > pfn_end))
+            order--;
+        buddy_free(mem_pool, pfn, order);
+        pfn += 1u << order;
+    }
+}
+
+
 /* 初始化内存池 */
 static void mem_pool_init(unsigned int mem_size)
 {
@@ -106,15 +196,10 @@ static void mem_pool_init(unsigned int mem_size)
     
     // 1页为4k,不管总内存是不是4k的倍数,
 	// 对于以页为单位的内存分配策略，不足1页的内存不用考虑了
-    unsigned short int all_free_pages = free_mem / PAGE_SIZE;
-    unsigned short int kernel_free_pages = all_free_pages / 2;
-    unsigned short int user_free_pages = all_free_pages - kernel_free_pages;
-    
-    // 位图中的一位表示一页4KB,以字节为单位
-    // 为简化位图操作，余数不处理，坏处是这样做会丢内存(1~7页)
-    // 好处是不用做内存的越界检查,因为位图表示的内存少于实际物理内存
-    unsigned int kbm_length = kernel_free_pages / 8;    // kernel bitmap长度
-    unsigned int ubm_length = user_free_pages / 8;      // user bitmap长度
+    // 页数用32位保存, 3GB内存也有78万多页, 16位是不够的
+    unsigned int all_free_pages = free_mem / PAGE_SIZE;
+    unsigned int kernel_free_pages = all_free_pages / 2;
+    unsigned int user_free_pages = all_free_pages - kernel_free_pages;
     
     // 物理内存池起始地址
     unsigned int kp_begin = used_mem;   // kernel pool start, 内核物理内存池的起始地址
@@ -126,64 +211,97 @@ static void mem_pool_init(unsigned int mem_size)
     kernel_pool.pool_size = kernel_free_pages * PAGE_SIZE;
     user_pool.pool_size = user_free_pages * PAGE_SIZE;
     
-    kernel_pool.pool_bitmap.bitmap_bytes_len = kbm_length;
-    user_pool.pool_bitmap.bitmap_bytes_len = ubm_length;
-    
     
-/*********    内核内存池和用户内存池位图   ***********
- *   位图是全局的数据，长度不固定。
- *   全局或静态的数组需要在编译时知道其长度，
- *   而我们需要在程序运行过程中根据总内存大小算出位图需要多少字节。
- *   所以改为指定一块内存来生成位图，这样就不需要固定长度了
+/*********    物理页描述符数组 mem_map 及内核虚拟地址位图   ***********
+ *   二者的大小都取决于物理内存大小, 需在运行时确定。
+ *   这里直接取内核物理内存池开头的若干页框来存放, 映射到内核堆的起始处K_HEAP_START,
+ *   内核堆开头依次为: mem_map, KMAP_SLOTS个临时映射窗口, 内核虚拟地址位图.
+ *   这些页框和虚拟页不再参与分配
  *   ************************************************/
-
-// 内核使用的最高地址是0xc009f000,这是主线程的栈地址.(内核的大小预计为70K左右)
-// 32M内存占用的位图是2k.内核内存池的位图先定在MEM_BITMAP_BASE(0xc009a000)处
-    kernel_pool.pool_bitmap.bits = (void *)MEM_BITMAP_BASE;
-
-// 用户内存池的位图紧跟在内核内存池位图之后
-    user_pool.pool_bitmap.bits = (void *)(MEM_BITMAP_BASE + kbm_length);
+    mem_map_count = mem_size / PAGE_SIZE;
+    unsigned int mem_map_pages = DIV_ROUND_UP(mem_map_count * sizeof(struct page_desc), PAGE_SIZE);
     
-    /******************** 输出内存池信息 **********************/
-    put_str("    kernel_pool_bitmap_start: 0x"); 
-    put_int((int)kernel_pool.pool_bitmap.bits);     // 内存池所用位图的起始地址
-    put_str("\n    kernel_pool_phy_addr_start: 0x"); 
-    put_int(kernel_pool.phy_addr_begin);    // 内存池的起始物理地址
+    // 内核可以向用户内存池借页框, 内核堆最多用上全部空闲内存, 但不能超出内核页表覆盖的范围
+    unsigned int kheap_pages = all_free_pages < K_HEAP_PAGES_MAX ? all_free_pages : K_HEAP_PAGES_MAX;
+    // 内核虚拟地址位图中的一位表示一页4KB,以字节为单位, 余数不处理
+    unsigned int kbm_length = kheap_pages / 8;    // kernel bitmap长度
+    // 摘要位图紧跟在位图之后, 按4字节对齐
+    unsigned int kbm_pages = DIV_ROUND_UP(DIV_ROUND_UP(kbm_length, 4) * 4 + BITMAP_SUMMARY_BYTES(kbm_length), PAGE_SIZE);
     
-    put_str("\n    user_pool_bitmap_start: 0x");
-    put_int((int)user_pool.pool_bitmap.bits);
-    put_str("\n    user_pool_phy_addr_start: 0x");
-    put_int(user_pool.phy_addr_begin);
-    put_char('\n');
+    unsigned int page_index;
+    for(page_index = 0; page_index < mem_map_pages; page_index++)
+        page_table_add((void *)(K_HEAP_START + page_index * PAGE_SIZE), \
+                       (void *)(kp_begin + page_index * PAGE_SIZE));
+    mem_map = (struct page_desc *)K_HEAP_START;
+    memset(mem_map, 0, mem_map_pages * PAGE_SIZE);
+    for(page_index = 0; page_index < mem_map_count; page_index++)
+        mem_map[page_index].flags = PD_RESERVED;
     
-/* 将位图置0初始化 
- * 位值为0表示该位对应的内存页未分配，为1表示已分配 */
-    bitmap_init(&kernel_pool.pool_bitmap);      // 初始化位图
-    bitmap_init(&user_pool.pool_bitmap);
-
+    // mem_map之后的KMAP_SLOTS个虚拟页留作临时映射窗口, 平时不映射任何页框
+    kmap_vaddr = K_HEAP_START + mem_map_pages * PAGE_SIZE;
+    kmap_depth = 0;
+    for(page_index = 0; page_index < KMAP_SLOTS; page_index++)
+        *pte_ptr(kmap_vaddr + page_index * PAGE_SIZE) = 0;
+    
+    /* 初始化内核虚拟地址池 */
+    // 用于维护内核堆的虚拟地址
+    unsigned int kbm_vaddr = kmap_vaddr + KMAP_SLOTS * PAGE_SIZE;
+    for(page_index = 0; page_index < kbm_pages; page_index++)
+        page_table_add((void *)(kbm_vaddr + page_index * PAGE_SIZE), \
+                       (void *)(kp_begin + (mem_map_pages + page_index) * PAGE_SIZE));
+    kernel_vaddr.vaddr_bitmap.bitmap_bytes_len = kbm_length;
+    kernel_vaddr.vaddr_bitmap.bits = (void *)kbm_vaddr;
+    kernel_vaddr.vaddr_bitmap.summary = (void *)(kbm_vaddr + DIV_ROUND_UP(kbm_length, 4) * 4);
+    
+    // 内核虚拟内存池的起始地址为K_HEAP_START
+    kernel_vaddr.vaddr_begin = K_HEAP_START;
+    bitmap_init(&kernel_vaddr.vaddr_bitmap);    // 初始化内核的虚拟内存池位图
+    
+    // 内核堆开头已被mem_map、临时映射窗口和位图自身占用的虚拟页
+    for(page_index = 0; page_index < mem_map_pages + KMAP_SLOTS + kbm_pages; page_index++)
+        bitmap_set(&kernel_vaddr.vaddr_bitmap, page_index, 1);
     
     // 初始化锁
     lock_init(&kernel_pool.lock);
     lock_init(&user_pool.lock);
-
-    
-    /* 初始化内核虚拟地址池 */
     
-    /* 初始化内核虚拟地址的位图，按实际物理内存大小生成数组 */
-    // 用于维护内核堆的虚拟地址，所以要和内核内存池大小一致
-    kernel_vaddr.vaddr_bitmap.bitmap_bytes_len = kbm_length;
+    /* 把两个内存池中的空闲页框交给伙伴系统 */
+    buddy_init(&kernel_pool, kp_begin + (mem_map_pages + kbm_pages) * PAGE_SIZE, up_begin);
+    buddy_init(&user_pool, up_begin, up_begin + user_free_pages * PAGE_SIZE);
     
-    /* 位图的数组指向一块未使用的内存,目前定位在内核内存池和用户内存池之外*/
-    // 这里将其安排在紧挨着内核内存池和用户内存池所用的位图之后
-    kernel_vaddr.vaddr_bitmap.bits = (void *)(MEM_BITMAP_BASE + kbm_length + ubm_length);
+    /******************** 输出内存池信息 **********************/
+    put_str("    mem_map_start: 0x");
+    put_int((int)mem_map);      // 物理页描述符数组的起始地址
+    put_str("\n    kernel_pool_phy_addr_start: 0x"); 
+    put_int(kernel_pool.phy_addr_begin);    // 内存池的起始物理地址
+    put_str("\n    user_pool_phy_addr_start: 0x");
+    put_int(user_pool.phy_addr_begin);
+    put_char('\n');
     
-    // 内核虚拟内存池的起始地址为K_HEAP_START，即0xc010 0000
-    kernel_vaddr.vaddr_begin = K_HEAP_START;
-    bitmap_init(&kernel_vaddr.vaddr_bitmap);    // 初始化内核的虚拟内存池位图
     put_str("    mem_pool_init done!\n");
 }
 
 
+/* 内核空间映射的优化: 内核空间的页都设为全局页(PGE), 切换进程页表写cr3时, TLB中内核空间的条目不会被清掉.
+ * 各进程的内核空间共用同一组页表, 映射完全相同, 因此可以设为全局页;
+ * 反过来, 改动内核空间的映射时必须用invlpg, 重新加载cr3刷不掉全局页 */
+// 低端1MB仍由loader建的页表逐页映射, 不改用4MB大页: 运行内核代码的ring3任务要访问低端1MB, 
+// 其页目录项US位须为1, 大页会把紧随其后的页目录表、页表和内核内存池也一并暴露给ring3
+static void kernel_paging_init(void)
+{
+    unsigned int eax = 1, ebx, ecx, edx, cr4;
+    asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    asm volatile("movl %%cr4, %0" : "=r" (cr4));
+    
+    if(edx & CPUID_PGE)
+    {
+        cr4 |= CR4_PGE;
+        asm volatile("movl %0, %%cr4" : : "r" (cr4) : "memory");
+        kernel_pte_global = PG_G;
+    }
+}
+
+
 /* 内存管理部分初始化入口 */
 void mem_init()
 {
@@ -193,11 +311,32 @@ void mem_init()
  * mem_total_size是用伪指令dd来定义的，宽度为32位。这里先把0x900转换成32位整型指针，
  * 再通过*对该指针做取值操作 */
     unsigned int mem_bytes_total = (*(unsigned int *)(0x900));  // 以字节为单位
+    kernel_paging_init();               // 内核空间改用全局页
     mem_pool_init(mem_bytes_total);     // 初始化内存池
     
     // 初始化每个mem_block_desc描述符数组, 为malloc做准备
     block_desc_init(k_block_descs);
     
+    // 置cr0的WP位, 内核写只读的用户页时也会引发缺页异常, 写时复制才不会被内核绕过
+    unsigned int cr0;
+    asm volatile("movl %%cr0, %0; orl $0x10000, %0; movl %0, %%cr0" : "=r" (cr0) : : "memory");
+    register_handler(0x0e, page_fault_handler);
+    
+    vm_area_cache_init();   // 进程虚拟内存区域的对象缓存
+    vaddr_region_cache_init();  // 进程已占用的虚拟地址区域的对象缓存
+    image_cache_init();         // 程序映像缓存
+    
+    // 从用户内存池中取一页作为共享零页
+    bool zeroed;
+    void *zero_phyaddr = palloc_zeroed(&user_pool, &zeroed);
+    ASSERT(zero_phyaddr != NULL);
+    zero_page_pfn = (unsigned int)zero_phyaddr / PAGE_SIZE;
+    enum intr_status old_status = intr_disable();
+    void *zero_page = kmap_atomic((unsigned int)zero_phyaddr);
+    memset(zero_page, 0, PAGE_SIZE);
+    kunmap_atomic(zero_page);
+    intr_set_status(old_status);
+    
     put_str("mem_init done!\n");
 }
 
@@ -222,18 +361,11 @@ static void *vaddr_get(enum pool_flags pf, unsigned int page_count)
             bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_index + counting++, 1);
         vaddr_begin = kernel_vaddr.vaddr_begin + bit_index * PAGE_SIZE;
     }
-    else    // 用户内存池
+    else    // 用户内存池, 在进程的区域链表中找一段空闲的地址
     {
-        struct task_struct *current = running_thread();
-        bit_index = bitmap_scan(&current->user_vaddr.vaddr_bitmap, page_count);
-        if(bit_index == -1)
+        vaddr_begin = vaddr_region_alloc(running_thread(), page_count);
+        if(vaddr_begin == 0)
             return NULL;
-        while(counting < page_count)
-            bitmap_set(&current->user_vaddr.vaddr_bitmap, bit_index + counting++, 1);
-        vaddr_begin = current->user_vaddr.vaddr_begin + bit_index * PAGE_SIZE;
-        
-        // (0xc000_0000 - PAGE_SIZE)作为用户3级栈已经在start_process被分配
-        ASSERT((unsigned int)vaddr_begin < (0xc0000000 - PAGE_SIZE));   // ???
     }
     return (void *)vaddr_begin;
 }
@@ -261,17 +393,282 @@ unsigned int *pde_ptr(unsigned int vaddr)
 }
 
 
+/* 刷新快表TLB中虚拟地址vaddr所在页的条目 */
+// invlpg的操作数是该页中的任意一个内存单元, 而不是存放地址的变量
+static void tlb_flush_page(unsigned int vaddr)
+{
+    asm volatile("invlpg %0" : : "m" (*(char *)vaddr) : "memory");
+}
+
+
+/* 重新加载cr3, 清空TLB中所有非全局的条目 */
+static void tlb_flush_all(void)
+{
+    unsigned int cr3;
+    asm volatile("movl %%cr3, %0; movl %0, %%cr3" : "=r" (cr3) : : "memory");
+}
+
+
+/* 刷新TLB中[vaddr, vaddr + page_count * PAGE_SIZE)内各页的条目
+ * 页数不多时逐页invlpg, 超过TLB_FLUSH_THRESHOLD则一次清空整个TLB */
+static void tlb_flush_range(unsigned int vaddr, unsigned int page_count)
+{
+    if(page_count <= TLB_FLUSH_THRESHOLD)
+    {
+        while(page_count--)
+        {
+            tlb_flush_page(vaddr);
+            vaddr += PAGE_SIZE;
+        }
+    }
+    else if(vaddr >= 0xc0000000 && kernel_pte_global)
+    {
+        // 内核空间是全局页, 重新加载cr3刷不掉, 要把cr4的PGE位关掉再打开
+        unsigned int cr4;
+        asm volatile("movl %%cr4, %0" : "=r" (cr4));
+        asm volatile("movl %0, %%cr4; movl %1, %%cr4" : : "r" (cr4 & ~CR4_PGE), "r" (cr4) : "memory");
+    }
+    else
+        tlb_flush_all();
+}
+
+
+/* 把物理页框page_phyaddr临时映射到内核空间, 返回其虚拟地址
+ * 调用者需关中断, 并在开中断之前按相反的次序调用kunmap_atomic */
+void *kmap_atomic(unsigned int page_phyaddr)
+{
+    ASSERT(intr_get_status() == INTR_OFF);
+    ASSERT(kmap_depth < KMAP_SLOTS);
+    
+    unsigned int vaddr = kmap_vaddr + kmap_depth++ * PAGE_SIZE;
+    *pte_ptr(vaddr) = (page_phyaddr & 0xfffff000) | kernel_pte_global | PG_US_S | PG_RW_W | PG_P_1;
+    tlb_flush_page(vaddr);
+    return (void *)vaddr;
+}
+
+
+/* 撤销kmap_atomic建立的临时映射 */
+void kunmap_atomic(void *vaddr)
+{
+    ASSERT(intr_get_status() == INTR_OFF);
+    ASSERT(kmap_depth > 0 && (unsigned int)vaddr == kmap_vaddr + (kmap_depth - 1) * PAGE_SIZE);
+    
+    kmap_depth--;
+    *pte_ptr((unsigned int)vaddr) = 0;
+    tlb_flush_page((unsigned int)vaddr);
+}
+
+
+/* 将以页框号pfn起始的2^order页作为空闲块挂到伙伴链表中, 不做合并 */
+static void buddy_insert(struct pool *mem_pool, unsigned int pfn, unsigned int order)
+{
+    struct page_desc *page = &mem_map[pfn];
+    page->order = order;
+    page->flags |= PD_BUDDY;
+    list_push(&mem_pool->free_area[order], &page->free_tag);
+}
+
+
+/* 把以页框号pfn起始的2^order页归还给伙伴系统, 并逐级与空闲的伙伴块合并
+ * 调用者需关中断 */
+static void buddy_free(struct pool *mem_pool, unsigned int pfn, unsigned int order)
+{
+    mem_pool->free_pages += 1u << order;
+    
+    while(order < MAX_ORDER - 1)
+    {
+        // 阶为order的块, 其伙伴块的起始页框号只在第order位上与之不同
+        unsigned int buddy_pfn = pfn ^ (1u << order);
+        if(buddy_pfn >= mem_map_count)
+            break;
+        
+        // 伙伴块须同属一个内存池, 且是同阶的空闲块, 才能合并
+        struct page_desc *buddy = &mem_map[buddy_pfn];
+        if(buddy->pool != mem_pool || !(buddy->flags & PD_BUDDY) || buddy->order != order)
+            break;
+        
+        list_remove(&buddy->free_tag);
+        buddy->flags &= ~PD_BUDDY;
+        pfn &= ~(1u << order);      // 合并后的块以二者中较低的页框起始
+        order++;
+    }
+    buddy_insert(mem_pool, pfn, order);
+}
+
+
+/* 在伙伴系统中分配2^order个物理上连续的页框, 成功返回起始页框号, 失败返回-1
+ * 调用者需关中断 */
+static signed int buddy_alloc(struct pool *mem_pool, unsigned int order)
+{
+    unsigned int cur_order = order;
+    
+    // 从够用的最小阶开始找空闲块
+    while(cur_order < MAX_ORDER && list_empty(&mem_pool->free_area[cur_order]))
+        cur_order++;
+    if(cur_order == MAX_ORDER)
+        return -1;
+    
+    struct page_desc *page = \
+        elem2entry(struct page_desc, free_tag, list_pop(&mem_pool->free_area[cur_order]));
+    page->flags &= ~PD_BUDDY;
+    unsigned int pfn = page - mem_map;
+    
+    // 分配出去的每一页都只有申请者一个使用者
+    unsigned int page_index;
+    for(page_index = 0; page_index < (1u << order); page_index++)
+        mem_map[pfn + page_index].ref_count = 1;
+    
+    // 块比需要的大, 就逐级对半拆分, 把高半部分作为低一阶的空闲块放回
+    while(cur_order > order)
+    {
+        cur_order--;
+        buddy_insert(mem_pool, pfn + (1u << cur_order), cur_order);
+    }
+    mem_pool->free_pages -= 1u << order;
+    return pfn;
+}
+
+
+/* 内存池mem_pool中没有够大的空闲块时, 从另一个内存池借一个至少2^order页的空闲块
+ * 借来的页框从此归mem_pool所有, 释放后回到mem_pool的伙伴系统, 对方缺页框时再用同样的方式借回去
+ * 成功返回true. 调用者需关中断 */
+static bool pool_borrow(struct pool *mem_pool, unsigned int order)
+{
+    struct pool *lender = mem_pool == &kernel_pool ? &user_pool : &kernel_pool;
+    
+    // 尽量借大块, 出借方剩余的页框不够时再降到刚好够用的阶
+    unsigned int lend_order = order > LEND_ORDER ? order : LEND_ORDER;
+    while(lend_order > order && (1u << lend_order) + LEND_RESERVE_PAGES > lender->free_pages)
+        lend_order--;
+    if((1u << lend_order) + LEND_RESERVE_PAGES > lender->free_pages)
+        return false;
+    
+    signed int pfn = buddy_alloc(lender, lend_order);
+    while(pfn == -1 && lend_order > order)
+        pfn = buddy_alloc(lender, --lend_order);
+    if(pfn == -1)
+        return false;
+    
+    unsigned int page_index, block_pages = 1u << lend_order;
+    for(page_index = 0; page_index < block_pages; page_index++)
+        mem_map[pfn + page_index].pool = mem_pool;
+    lender->pool_size -= block_pages * PAGE_SIZE;
+    mem_pool->pool_size += block_pages * PAGE_SIZE;
+    
+    buddy_free(mem_pool, pfn, lend_order);
+    return true;
+}
+
+
+/* 从内存池的预清0页框链表中取出一页, 成功返回其物理地址, 没有则返回NULL
+ * 调用者需关中断 */
+static void *zero_page_pop(struct pool *mem_pool)
+{
+    if(list_empty(&mem_pool->zero_list))
+        return NULL;
+    
+    struct page_desc *page = \
+        elem2entry(struct page_desc, free_tag, list_pop(&mem_pool->zero_list));
+    page->flags &= ~PD_ZEROED;
+    mem_pool->zero_pages--;
+    mem_pool->free_pages--;
+    return (void *)((page - mem_map) * PAGE_SIZE);
+}
+
+
+/* 内核内存池已空、用户内存池的空闲页又不够出借时, 释放映像缓存中没有进程在用的页,
+ * 一次补足用户内存池出借1页所差的页数, 之后的pool_borrow就能借到
+ * 释放缓存页要关闭inode、归还slab对象和页框, 可能要等锁, 所以只在开中断时回收;
+ * 关中断时的申请(如cow_share_user_space)不回收, 只用现有的和能借到的页框 */
+static void kernel_pool_refill(void)
+{
+    if(intr_get_status() == INTR_OFF)
+        return;
+    
+    // 只是估计, 不关中断读空闲页数, 回收多了少了都无妨
+    unsigned int lend_need = 1 + LEND_RESERVE_PAGES;
+    if(kernel_pool.free_pages > 0 || user_pool.free_pages >= lend_need)
+        return;
+    image_cache_shrink(lend_need - user_pool.free_pages);
+}
+
+
+/* 在mem_pool指向的物理内存池中分配2^order个物理上连续的页，
+ * 成功则返回起始页的物理地址，失败则返回NULL */
+static void *palloc_pages(struct pool *mem_pool, unsigned int order)
+{
+    // 内核内存池连一页都没有时先腾出可借的页框; 用户内存池自己不够时由palloc_user腾出页框,
+    // 申请大块失败的调用者会降阶重试, 不必为大块清空缓存
+    if(mem_pool == &kernel_pool && order == 0)
+        kernel_pool_refill();
+    
+    // 操作伙伴链表要保证原子操作
+    enum intr_status old_status = intr_disable();
+    signed int pfn = buddy_alloc(mem_pool, order);
+    
+    // 伙伴系统中没有空闲页了, 单页的申请还可以用预清0的页框
+    void *page_phyaddr = pfn == -1 ? \
+        (order == 0 ? zero_page_pop(mem_pool) : NULL) : (void *)((unsigned int)pfn * PAGE_SIZE);
+    
+    // 还不够就向另一个内存池借
+    if(page_phyaddr == NULL && pool_borrow(mem_pool, order))
+        page_phyaddr = (void *)((unsigned int)buddy_alloc(mem_pool, order) * PAGE_SIZE);
+    intr_set_status(old_status);
+    return page_phyaddr;
+}
+
+
+/* 在内存池中分配一页用作需要清0的内存, 优先取预清0的页框
+ * 成功返回其物理地址并通过zeroed告知该页是否已清0, 失败返回NULL */
+static void *palloc_zeroed(struct pool *mem_pool, bool *zeroed)
+{
+    enum intr_status old_status = intr_disable();
+    void *page_phyaddr = zero_page_pop(mem_pool);
+    intr_set_status(old_status);
+    
+    *zeroed = page_phyaddr != NULL;
+    return *zeroed ? page_phyaddr : palloc_pages(mem_pool, 0);
+}
+
+
+/* 为内存池补充一个预清0的页框, 两个内存池的预清0页框都已够数或没有空闲页框时返回false
+ * 供idle线程在系统空闲时调用. idle线程不能因等锁而阻塞, 因此这里不获取内存池的锁, 只关中断 */
+bool zero_page_fill(void)
+{
+    // 先给预清0页框少的内存池补充
+    struct pool *mem_pool = \
+        kernel_pool.zero_pages <= user_pool.zero_pages ? &kernel_pool : &user_pool;
+    if(mem_pool->zero_pages >= ZERO_PAGES_MAX)
+        return false;
+    
+    enum intr_status old_status = intr_disable();
+    signed int pfn = buddy_alloc(mem_pool, 0);
+    if(pfn == -1)
+    {
+        intr_set_status(old_status);
+        return false;
+    }
+    
+    // 页框尚未映射到内核空间, 借临时映射窗口清0
+    void *page = kmap_atomic(pfn * PAGE_SIZE);
+    memset(page, 0, PAGE_SIZE);
+    kunmap_atomic(page);
+    
+    // 预清0的页框仍算作空闲页
+    mem_map[pfn].flags |= PD_ZEROED;
+    list_append(&mem_pool->zero_list, &mem_map[pfn].free_tag);
+    mem_pool->zero_pages++;
+    mem_pool->free_pages++;
+    intr_set_status(old_status);
+    return true;
+}
+
+
 /* 在mem_pool指向的物理内存池中分配一个物理页，
  * 成功则返回页的物理地址，失败则返回NULL */
 static void *palloc(struct pool *mem_pool)
 {
-    // 扫描或设置位图要保证原子操作
-    int bit_index = bitmap_scan(&mem_pool->pool_bitmap, 1); // 找一个物理页
-    if(bit_index == -1)
-        return NULL;
-    bitmap_set(&mem_pool->pool_bitmap, bit_index, 1);
-    unsigned int page_phyaddr = bit_index * PAGE_SIZE + mem_pool->phy_addr_begin;
-    return (void *)page_phyaddr;
+    return palloc_pages(mem_pool, 0);
 }
 
 
@@ -283,6 +680,9 @@ static void page_table_add(void *_vaddr, void *_page_phyaddr)
     unsigned int *pde = pde_ptr(vaddr);
     unsigned int *pte = pte_ptr(vaddr);
     
+    // 内核空间的页设为全局页
+    unsigned int global = vaddr >= 0xc0000000 ? kernel_pte_global : 0;
+    
 /************************   注意   *************************
  * 执行*pte,会访问到空的pde。所以确保pde创建完成后才能执行*pte,
  * 否则会引发page_fault。因此在*pde为0时,*pte只能出现在下面else语句块中的*pde后面。
@@ -293,15 +693,16 @@ static void page_table_add(void *_vaddr, void *_page_phyaddr)
         ASSERT(!(*pte & 0x00000001));   // 断言: pte的P位为不存在
         
         if(!(*pte & 0x00000001))    // 创建页表。pte就应该不存在,多判断一下放心
-            *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1); // US=1 RW=1 P=1
+            *pte = (page_phyaddr | global | PG_US_U | PG_RW_W | PG_P_1); // US=1 RW=1 P=1
         else
             // 调试模式下不会执行到此,上面的ASSERT会先执行.关闭调试时下面的PANIC会起作用
             PANIC("pte repeat");
     }
     else    // 页目录项不存在，所以要先申请一个物理页作为页表并创建页目录项
     {
-        // 页表中用到的页一律从内核空间分配
-        unsigned int pde_phyaddr = (unsigned int)palloc(&kernel_pool);
+        // 页表中用到的页一律从内核空间分配, 优先用预清0的页框
+        bool zeroed;
+        unsigned int pde_phyaddr = (unsigned int)palloc_zeroed(&kernel_pool, &zeroed);
         *pde = pde_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
         
         /* 分配到的物理页地址pde_phyaddr对应的物理内存清0,
@@ -309,10 +710,11 @@ static void page_table_add(void *_vaddr, void *_page_phyaddr)
          * 访问到pde对应的物理地址,用pte取高20位便可.
          * 因为pte是基于该pde对应的物理地址内再寻址,
          * 把低12位置0便是该pde对应的物理页的起始 */
-        memset((void *)((int)pte & 0xfffff000), 0, PAGE_SIZE);
+        if(!zeroed)
+            memset((void *)((int)pte & 0xfffff000), 0, PAGE_SIZE);
         
         ASSERT(!(*pte & 0x00000001));   // 断言: pte的P位为不存在
-        *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+        *pte = (page_phyaddr | global | PG_US_U | PG_RW_W | PG_P_1);
     }
 }
 
@@ -321,41 +723,101 @@ static void page_table_add(void *_vaddr, void *_page_phyaddr)
  * 虚拟地址是连续的，但物理地址可能连续，也可能不连续
  * 一次性申请page_count个虚拟页，成功申请之后，根据申请的页数，通过循环
  * 依次为每一个虚拟页申请物理页，再将它们在页表中依次映射关联 */
-
-void *malloc_page(enum pool_flags pf, unsigned int page_count)
+/* zero为true时返回的内存已清0, 其中用到的预清0页框不必再清0 */
+static void *__malloc_page(enum pool_flags pf, unsigned int page_count, bool zero)
 {
-    // 本项目中设置的总内存为32M(bochsrc.cfg)，内核和用户空间各约16MB，
-    // 保守起见用15MB来限制。15M/4KB=3840页
-    ASSERT(page_count > 0 && page_count < 3840);
+    ASSERT(page_count > 0);
+    
+    // 物理页不够就不必再去申请虚拟地址了, 本内存池不够时可以向另一个内存池借, 用户页还可以换出
+    // 映像缓存中没有进程在用的页随时可以释放, 也算作空闲页, 空闲页不够时才去数
+    unsigned int swappable_pages = pf == PF_USER ? swap_free_slots() : 0;
+    unsigned int free_pages = kernel_pool.free_pages + user_pool.free_pages + swappable_pages;
+    if(page_count > free_pages && page_count > free_pages + image_cache_reclaimable())
+        return NULL;
     
 /***********   malloc_page的原理是三个动作的合成:   ***********
       1 通过vaddr_get在虚拟内存池中申请虚拟地址
-      2 通过palloc在物理内存池中申请物理页
+      2 通过palloc_pages在物理内存池中申请物理页
       3 通过page_table_add将以上得到的虚拟地址和物理地址在页表中完成映射
 ***************************************************************/ 
 
     void *vaddr_begin = vaddr_get(pf, page_count);
-    if(vaddr_begin == NULL)
+    if(vaddr_begin == NULL || !pages_map(pf, vaddr_begin, page_count, zero))
         return NULL;
-    
-    unsigned int vaddr = (unsigned int)vaddr_begin, count = page_count;
+    return vaddr_begin;
+}
+
+
+/* 为已申请到的以vaddr_begin起始的page_count个虚拟页分配物理页并映射
+ * 失败时把已映射的页框和这些虚拟地址全部归还, 返回false */
+static bool pages_map(enum pool_flags pf, void *vaddr_begin, unsigned int page_count, bool zero)
+{
     struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+    unsigned int vaddr = (unsigned int)vaddr_begin, count = page_count;
     
-    /* 虚拟地址是连续的，但物理地址可以是不连续的，所以逐个做映射 */
-    while(count-- > 0)
+    /* 虚拟地址是连续的，但物理地址可以是不连续的。
+     * 每次向伙伴系统申请不超过剩余页数的最大2次幂块, 申请不到再降阶, 然后逐页做映射 */
+    while(count > 0)
     {
-        void *page_phyaddr = palloc(mem_pool);
+        unsigned int order = 0;
+        bool zeroed = false;
+        void *page_phyaddr = NULL;
+        
+        // 需要清0的内存优先逐页取预清0的页框
+        if(zero)
+        {
+            enum intr_status old_status = intr_disable();
+            page_phyaddr = zero_page_pop(mem_pool);
+            intr_set_status(old_status);
+            zeroed = page_phyaddr != NULL;
+        }
+        
         if(page_phyaddr == NULL)
         {
-            // 物理页申请失败时，应将曾经已申请的虚拟地址和物理页全部回滚，
-            // 如果物理内存池的位图也被修改过，还要再把物理地址回滚
-            // 在将来完成内存回收时再补充
-            return NULL;
+            while(order < MAX_ORDER - 1 && (2u << order) <= count)
+                order++;
+            
+            page_phyaddr = palloc_pages(mem_pool, order);
+            while(page_phyaddr == NULL && order > 0)
+                page_phyaddr = palloc_pages(mem_pool, --order);
+            
+            // 用户内存池连一页都分不出时, 腾出一页再试
+            while(page_phyaddr == NULL && pf == PF_USER && user_page_reclaim())
+                page_phyaddr = palloc(mem_pool);
+        }
+        
+        if(page_phyaddr == NULL)
+        {
+            // 物理页申请失败时，将已映射的页框和申请的虚拟地址全部回滚
+            unsigned int mapped = page_count - count;
+            if(mapped > 0)
+                mfree_page(pf, vaddr_begin, mapped);
+            vaddr_remove(pf, (void *)vaddr, count);
+            return false;
+        }
+        
+        unsigned int block_pages = 1u << order;
+        void *block_vaddr = (void *)vaddr;
+        count -= block_pages;
+        while(block_pages-- > 0)
+        {
+            page_table_add((void *)vaddr, page_phyaddr);  // 在页表中做映射
+            vaddr += PAGE_SIZE;     // 下一个虚拟页
+            page_phyaddr = (void *)((unsigned int)page_phyaddr + PAGE_SIZE);
         }
-        page_table_add((void *)vaddr, page_phyaddr); // 在页表中做映射
-        vaddr += PAGE_SIZE;     // 下一个虚拟页
+        
+        // 从伙伴系统取来的页框内容是陈旧的, 映射后再清0
+        if(zero && !zeroed)
+            memset(block_vaddr, 0, (1u << order) * PAGE_SIZE);
     }
-    return vaddr_begin;
+    return true;
+}
+
+
+/* 分配page_count个页空间, 内容不清0 */
+void *malloc_page(enum pool_flags pf, unsigned int page_count)
+{
+    return __malloc_page(pf, page_count, false);
 }
 
 
@@ -365,11 +827,9 @@ void *get_kernel_pages(unsigned int page_count)
 {
     lock_acquire(&kernel_pool.lock);
     
-    void *vaddr = malloc_page(PF_KERNEL, page_count);
-    if(vaddr != NULL)
-        // 若分配的地址不为空，将页清0后返回
-        memset(vaddr, 0, page_count * PAGE_SIZE);
-        
+    // 返回的页已清0
+    void *vaddr = __malloc_page(PF_KERNEL, page_count, true);
+    
     lock_release(&kernel_pool.lock);
     return vaddr;
 }
@@ -381,12 +841,29 @@ void *get_kernel_pages(unsigned int page_count)
 
 
 
+/* 释放由get_kernel_pages申请的以vaddr起始的page_count页内核内存 */
+void free_kernel_pages(void *vaddr, unsigned int page_count)
+{
+    lock_acquire(&kernel_pool.lock);
+    mfree_page(PF_KERNEL, vaddr, page_count);
+    lock_release(&kernel_pool.lock);
+}
+
+
+/* 释放由get_user_pages或mmap得到的以vaddr起始的page_count页用户内存, 未分配页框的页跳过 */
+void free_user_pages(void *vaddr, unsigned int page_count)
+{
+    lock_acquire(&user_pool.lock);
+    mfree_page(PF_USER, vaddr, page_count);
+    lock_release(&user_pool.lock);
+}
+
+
 /* 在用户空间中申请4K内存，并返回其虚拟地址 */
 void *get_user_pages(unsigned int page_count)
 {
     lock_acquire(&user_pool.lock);
-    void *vaddr = malloc_page(PF_USER, page_count);
-    memset(vaddr, 0, page_count * PAGE_SIZE);
+    void *vaddr = __malloc_page(PF_USER, page_count, true);
     lock_release(&user_pool.lock);
     return vaddr;
 }
@@ -402,16 +879,18 @@ void *get_a_page(enum pool_flags pf, unsigned int vaddr)
     
     lock_acquire(&mem_pool->lock);
     
-    /* 先将虚拟地址对应的位图置1 */
+    /* 先将虚拟地址登记为已占用 */
     struct task_struct *current = running_thread();
     signed int bitmap_index = -1;
     
-    // 如果是用户进程申请用户内存，则修改用户进程自己的虚拟地址位图
+    // 如果是用户进程申请用户内存，则登记到用户进程自己的区域链表中
     if(current->pgdir != NULL && pf == PF_USER)
     {
-        bitmap_index = (vaddr - current->user_vaddr.vaddr_begin) / PAGE_SIZE;
-        ASSERT(bitmap_index >= 0);
-        bitmap_set(&current->user_vaddr.vaddr_bitmap, bitmap_index, 1);
+        if(!vaddr_region_reserve(current, vaddr, 1))
+        {
+            lock_release(&mem_pool->lock);
+            return NULL;
+        }
     }
     // 如果是内核线程申请内核内存，则修改kernel_vaddr
     else if(current->pgdir == NULL && pf == PF_KERNEL)
@@ -423,25 +902,7 @@ void *get_a_page(enum pool_flags pf, unsigned int vaddr)
     else
         PANIC("[ERROR]get_a_page: not allow kernel alloc userspace or user alloc kernelspace\n");
     
-    void *page_phyaddr = palloc(mem_pool);
-    if(page_phyaddr == NULL)
-        return NULL;
-    page_table_add((void *)vaddr, page_phyaddr);
-    
-    lock_release(&mem_pool->lock);
-    return (void *)vaddr;
-}
-
-
-
-/* 安装1页大小的vaddr, 专门针对fork时虚拟地址位图无需操作的情况 */
-// 为指定的vaddr分配一物理页, 但无需从虚拟地址内存池中设置位图
-void *get_a_page_without_operate_vaddrbitmap(enum pool_flags pf, unsigned int vaddr)
-{
-    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
-    
-    lock_acquire(&mem_pool->lock);
-    void *page_phyaddr = palloc(mem_pool);
+    void *page_phyaddr = pf == PF_USER ? palloc_user(NULL) : palloc(mem_pool);
     if(page_phyaddr == NULL)
     {
         lock_release(&mem_pool->lock);
@@ -470,36 +931,757 @@ unsigned int addr_v2p(unsigned int vaddr)
 
 
 
+/***** 写时复制 copy-on-write *****/
 
-
-/***** 实现 sys_malloc 小内存申请 16 32 64 128 256 512 1024*****/
-
-
-/* 返回arena中第index个内存块的地址 */
-static struct mem_block *arena2block(struct arena *ar, unsigned int index)
+/* 从*elem指向的区域起, 找当前进程中不小于pde_index且与某个区域重叠的页目录项下标
+ * *elem随之后移, 找不到返回768. 只有这些页目录项下才可能有映射着页框的页表项 */
+static unsigned int user_pde_next(struct list_elem **elem, unsigned int pde_index)
 {
-    return (struct mem_block *) \
-           ((unsigned int)ar + sizeof(struct arena) + index * ar->desc->block_size);
+    struct task_struct *current = running_thread();
+    while(*elem != &current->vaddr_regions.tail)
+    {
+        struct vaddr_region *region = elem2entry(struct vaddr_region, region_tag, *elem);
+        if(pde_index < region->start / 0x400000)
+            pde_index = region->start / 0x400000;
+        // 相邻区域可能落在同一个页目录项中, 已处理过的页目录项不会再返回
+        if(pde_index < DIV_ROUND_UP(region->end, 0x400000))
+            return pde_index;
+        *elem = (*elem)->next;
+    }
+    return 768;
 }
 
 
-/* 返回内存块block所在的arena地址 */
-static struct arena *block2arena(struct mem_block *bk)
+/* fork时让子进程的页目录child_pgdir与当前进程共享用户空间中所有已映射的页框
+ * 可写的页在父子进程中都改为只读并打上PG_COW标记, 哪一方先写, 缺页异常时再为其复制一份
+ * 子进程的页表页框没有映射到内核空间, 借临时映射窗口填写. 成功返回true
+ * 调用者需关中断 */
+bool cow_share_user_space(unsigned int *child_pgdir)
 {
-    // mem_block 是在页框的基础上做的细分, &0xffff_f000 即得到对应页框的基地址
-    return (struct arena *) ((unsigned int)bk & 0xfffff000);
+    ASSERT(intr_get_status() == INTR_OFF);
+    
+    // 用户空间3G, 对应前768个页目录项, 只需看进程区域所在的那些
+    unsigned int pde_index, pte_index;
+    struct list_elem *elem = running_thread()->vaddr_regions.head.next;
+    for(pde_index = user_pde_next(&elem, 0); pde_index < 768; pde_index = user_pde_next(&elem, pde_index + 1))
+    {
+        if(!(*pde_ptr(pde_index * 0x400000) & PG_P_1))
+            continue;
+        
+        // 子进程的页表和页目录一样从内核内存池中分配
+        bool zeroed;
+        void *pt_phyaddr = palloc_zeroed(&kernel_pool, &zeroed);
+        if(pt_phyaddr == NULL)
+            return false;
+        
+        unsigned int *child_pt = kmap_atomic((unsigned int)pt_phyaddr);
+        if(!zeroed)
+            memset(child_pt, 0, PAGE_SIZE);
+        
+        unsigned int *parent_pt = pte_ptr(pde_index * 0x400000);
+        for(pte_index = 0; pte_index < 1024; pte_index++)
+        {
+            unsigned int pte = parent_pt[pte_index];
+            // 已换出的页不必换入, 子进程的页表项指向同一个交换槽, 各自换入时得到私有的副本
+            if(!(pte & PG_P_1) && (pte & PG_SWAPPED))
+            {
+                child_pt[pte_index] = pte;
+                swap_slot_dup(pte >> 12);
+            }
+            if(!(pte & PG_P_1))
+                continue;
+            
+            // 只读的页本来就不会被写, 共享映射的页本来就要共用, 直接共享即可
+            if(!(pte & PG_SHARED) && (pte & (PG_RW_W | PG_COW)))
+                pte = (pte & ~PG_RW_W) | PG_COW;
+            parent_pt[pte_index] = child_pt[pte_index] = pte;
+            if((pte >> 12) != zero_page_pfn)
+                mem_map[pte >> 12].ref_count++;
+        }
+        kunmap_atomic(child_pt);
+        
+        child_pgdir[pde_index] = (unsigned int)pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+    }
+    
+    // 父进程的可写页都改成了只读, TLB中的旧条目要作废
+    tlb_flush_all();
+    return true;
 }
 
 
+/* 撤销cow_share_user_space: fork失败时释放子进程页目录child_pgdir下的用户页表
+ * 子进程对页框和交换槽的引用都减回去. 父进程的页仍是写时复制的, 引用数回到1后再写时直接改回可写 */
+void cow_unshare_user_space(unsigned int *child_pgdir)
+{
+    ASSERT(intr_get_status() == INTR_OFF);
+    
+    unsigned int pde_index, pte_index;
+    for(pde_index = 0; pde_index < 768; pde_index++)
+    {
+        if(!(child_pgdir[pde_index] & PG_P_1))
+            continue;
+        
+        unsigned int pt_phyaddr = child_pgdir[pde_index] & 0xfffff000;
+        child_pgdir[pde_index] = 0;
+        unsigned int *child_pt = kmap_atomic(pt_phyaddr);
+        for(pte_index = 0; pte_index < 1024; pte_index++)
+        {
+            unsigned int pte = child_pt[pte_index];
+            if(pte & PG_P_1)
+                pfree(pte & 0xfffff000);
+            else if(pte & PG_SWAPPED)
+                swap_slot_put(pte >> 12);
+        }
+        kunmap_atomic(child_pt);
+        pfree(pt_phyaddr);
+    }
+}
+
+
+/* 处理对写时复制页vaddr的写操作, 成功返回true
+ * 若页框只剩当前进程在用, 直接恢复可写; 否则复制一份独占的页框 */
+static bool cow_fault(unsigned int vaddr)
+{
+    if(!(*pde_ptr(vaddr) & PG_P_1))
+        return false;
+    unsigned int *pte = pte_ptr(vaddr);
+    if((*pte & (PG_P_1 | PG_COW)) != (PG_P_1 | PG_COW))
+        return false;
+    
+    struct page_desc *page = &mem_map[*pte >> 12];
+    bool is_zero_page = (*pte >> 12) == zero_page_pfn;
+    if(is_zero_page || page->ref_count > 1)
+    {
+        // 写零页时要的只是一个清0的页框, 不必复制
+        bool zeroed = false;
+        unsigned int old_pte = *pte;
+        void *page_phyaddr = palloc_user(is_zero_page ? &zeroed : NULL);
+        if(page_phyaddr == NULL)
+            return false;
+        
+        // 分配时若换出了别的页会阻塞, 期间本页可能被换出, 共享者也可能都已退出,
+        // 这时放弃新页框, 返回后重新执行写操作, 再按新的情况处理. 时钟清掉的访问位不算改动
+        if(((*pte ^ old_pte) & ~PG_A) || (!is_zero_page && page->ref_count == 1))
+        {
+            pfree((unsigned int)page_phyaddr);
+            return true;
+        }
+        
+        // 旧页框仍映射在vaddr处, 新页框借临时映射窗口填写
+        void *dst = kmap_atomic((unsigned int)page_phyaddr);
+        if(is_zero_page)
+        {
+            if(!zeroed)
+                memset(dst, 0, PAGE_SIZE);
+        }
+        else
+            memcpy(dst, (void *)(vaddr & 0xfffff000), PAGE_SIZE);
+        kunmap_atomic(dst);
+        
+        if(!is_zero_page)
+            page->ref_count--;
+        *pte = (unsigned int)page_phyaddr | (*pte & 0x00000fff);
+    }
+    *pte = (*pte & ~PG_COW) | PG_RW_W;
+    tlb_flush_page(vaddr);
+    return true;
+}
+
+
+/* 缺页异常#PF的错误码 */
+#define PF_ERR_P    1   // 为1表示页存在, 是违反保护引起的; 为0表示页不存在
+#define PF_ERR_W    2   // 为1表示写操作引起的
+
+/* 缺页异常处理程序 */
+// 中断入口程序压入的中断号就是本函数的参数, 其所在位置正是中断栈intr_stack的起始
+static void page_fault_handler(unsigned int vec_id)
+{
+    struct intr_stack *frame = (struct intr_stack *)&vec_id;
+    unsigned int fault_vaddr;
+    asm volatile("movl %%cr2, %0" : "=r" (fault_vaddr));    // cr2 是存放造成page_fault的地址
+    
+    // 只处理用户进程用户空间中的缺页, 内核代读写用户缓冲区引起的缺页也在其中
+    if(fault_vaddr < 0xc0000000 && running_thread()->pgdir != NULL)
+    {
+        // 页存在, 是写了写时复制页
+        if((frame->err_code & (PF_ERR_P | PF_ERR_W)) == (PF_ERR_P | PF_ERR_W) && cow_fault(fault_vaddr))
+            return;
+        
+        // 页不存在且已被换出, 从交换分区换入
+        if(!(frame->err_code & PF_ERR_P) && page_swapped(fault_vaddr))
+        {
+            if(swap_in_page(fault_vaddr))
+                return;
+        }
+        // 页不存在, 按需为所在的区域分配页框
+        else if(!(frame->err_code & PF_ERR_P) && vm_area_fault(fault_vaddr, frame->err_code & PF_ERR_W))
+            return;
+    }
+    
+    // 其余的缺页都是真正的错误
+    general_intr_handler(vec_id);
+}
+
+
+/* 为当前进程用户空间中的vaddr映射一页清0的可写页框, 不操作虚拟地址位图
+ * 缺页异常中按需分配时使用, 成功返回vaddr, 失败返回NULL */
+void *map_zeroed_user_page(unsigned int vaddr)
+{
+    lock_acquire(&user_pool.lock);
+    bool zeroed;
+    void *page_phyaddr = palloc_user(&zeroed);
+    if(page_phyaddr != NULL)
+        page_table_add((void *)vaddr, page_phyaddr);
+    lock_release(&user_pool.lock);
+    
+    if(page_phyaddr == NULL)
+        return NULL;
+    if(!zeroed)
+        memset((void *)vaddr, 0, PAGE_SIZE);
+    return (void *)vaddr;
+}
+
+
+/* 为用户进程申请page_count页的大块内存, 只为首页分配页框存放arena元信息,
+ * 其余的页登记为匿名区域, 首次访问时才分配清0的页框. 调用者需持有用户内存池的锁 */
+static void *malloc_user_pages_lazy(unsigned int page_count)
+{
+    void *vaddr = vaddr_get(PF_USER, page_count);
+    if(vaddr == NULL)
+        return NULL;
+    
+    if(map_zeroed_user_page((unsigned int)vaddr) == NULL)
+    {
+        vaddr_remove(PF_USER, vaddr, page_count);
+        return NULL;
+    }
+    
+    unsigned int lazy_start = (unsigned int)vaddr + PAGE_SIZE;
+    if(page_count > 1 && vm_area_create(running_thread(), lazy_start, lazy_start + (page_count - 1) * PAGE_SIZE, \
+                                        VM_WRITE, NULL, 0, 0, 0) == NULL)
+    {
+        mfree_page(PF_USER, vaddr, page_count);
+        return NULL;
+    }
+    return vaddr;
+}
+
+
+/* 为当前进程用户空间中的vaddr映射共享零页, 不操作虚拟地址位图
+ * writable为true时打上PG_COW标记, 写时再换成私有的页框. 成功返回true */
+bool map_zero_page(unsigned int vaddr, bool writable)
+{
+    page_table_add((void *)vaddr, (void *)(zero_page_pfn * PAGE_SIZE));
+    unsigned int *pte = pte_ptr(vaddr);
+    *pte &= ~PG_RW_W;
+    if(writable)
+        *pte |= PG_COW;
+    return true;
+}
+
+
+/* 把用户空间中已映射的vaddr所在页改为只读 */
+void user_page_write_protect(unsigned int vaddr)
+{
+    *pte_ptr(vaddr) &= ~PG_RW_W;
+    tlb_flush_page(vaddr);
+}
+
+
+/* 从用户内存池中分配一个清0的页框, 不做映射, 成功返回其物理地址, 失败返回0 */
+unsigned int user_frame_alloc(void)
+{
+    lock_acquire(&user_pool.lock);
+    bool zeroed;
+    void *page_phyaddr = palloc_user(&zeroed);
+    lock_release(&user_pool.lock);
+    
+    if(page_phyaddr != NULL && !zeroed)
+    {
+        // 页框没有映射, 借临时映射窗口清0
+        enum intr_status old_status = intr_disable();
+        void *page = kmap_atomic((unsigned int)page_phyaddr);
+        memset(page, 0, PAGE_SIZE);
+        kunmap_atomic(page);
+        intr_set_status(old_status);
+    }
+    return (unsigned int)page_phyaddr;
+}
+
+
+/* 页框page_phyaddr的引用计数加1, 用free_a_phy_page减回 */
+void user_frame_get(unsigned int page_phyaddr)
+{
+    enum intr_status old_status = intr_disable();
+    ASSERT(mem_map[page_phyaddr / PAGE_SIZE].ref_count > 0);
+    mem_map[page_phyaddr / PAGE_SIZE].ref_count++;
+    intr_set_status(old_status);
+}
+
+
+/* 返回页框page_phyaddr的引用计数 */
+unsigned int page_ref_count(unsigned int page_phyaddr)
+{
+    return mem_map[page_phyaddr / PAGE_SIZE].ref_count;
+}
+
+
+/* 把已分配的页框page_phyaddr作为共享页映射到当前进程用户空间的vaddr处, 页框的引用计数加1 */
+void map_shared_user_page(unsigned int vaddr, unsigned int page_phyaddr, bool writable)
+{
+    lock_acquire(&user_pool.lock);
+    page_table_add((void *)vaddr, (void *)page_phyaddr);
+    lock_release(&user_pool.lock);
+    
+    enum intr_status old_status = intr_disable();
+    mem_map[page_phyaddr / PAGE_SIZE].ref_count++;
+    intr_set_status(old_status);
+    
+    // 新建的映射不在TLB中, 直接改页表项即可
+    unsigned int *pte = pte_ptr(vaddr);
+    *pte |= PG_SHARED;
+    if(!writable)
+        *pte &= ~PG_RW_W;
+}
+
+
+/* 把用户空间中已映射的vaddr所在页标记为共享页, fork时父子进程共用该页框而不是写时复制 */
+void user_page_set_shared(unsigned int vaddr)
+{
+    *pte_ptr(vaddr) |= PG_SHARED;
+}
+
+
+/* 若用户空间中vaddr所在的页已映射且被写过, 清除其脏位并返回true, 否则返回false */
+bool user_page_clear_dirty(unsigned int vaddr)
+{
+    if(!(*pde_ptr(vaddr) & PG_P_1))
+        return false;
+    
+    unsigned int *pte = pte_ptr(vaddr);
+    if((*pte & (PG_P_1 | PG_D)) != (PG_P_1 | PG_D))
+        return false;
+    
+    // 脏位由CPU在写页时置1, TLB中缓存的条目也要作废, 下次写时才会重新置位
+    *pte &= ~PG_D;
+    tlb_flush_page(vaddr);
+    return true;
+}
+
+
+/* 释放当前进程用户空间中页表项pte映射的页框或交换槽, 并清空该页表项
+ * 别的任务换出页面时会扫描本进程的页表, 读取、清空页表项和释放要在关中断下一起完成,
+ * 否则已归还的页框可能被分给别的进程后, 又被扫描当作本进程的页换出 */
+static void user_pte_release(unsigned int *pte)
+{
+    enum intr_status old_status = intr_disable();
+    unsigned int entry = *pte;
+    *pte = 0;
+    if(entry & PG_P_1)
+    {
+        ASSERT(mem_map[entry >> 12].pool == &user_pool);
+        pfree(entry & 0xfffff000);
+    }
+    else if(entry & PG_SWAPPED)     // 已换出的页归还其交换槽
+        swap_slot_put(entry >> 12);
+    intr_set_status(old_status);
+}
+
+
+/* 释放当前进程用户空间中的所有页框及页表, 并清空用户空间的页目录项
+ * 与其它进程共享的页框只减少引用计数 */
+void release_user_space(void)
+{
+    heap_profile_release();
+    
+    // 映射着页框的页表项都在进程区域所在的页目录项下
+    unsigned int pde_index, pte_index;
+    struct list_elem *elem = running_thread()->vaddr_regions.head.next;
+    for(pde_index = user_pde_next(&elem, 0); pde_index < 768; pde_index = user_pde_next(&elem, pde_index + 1))
+    {
+        if(!(*pde_ptr(pde_index * 0x400000) & PG_P_1))
+            continue;
+        
+        unsigned int *pt = pte_ptr(pde_index * 0x400000);
+        for(pte_index = 0; pte_index < 1024; pte_index++)
+        {
+            if(pt[pte_index] & (PG_P_1 | PG_SWAPPED))
+                user_pte_release(&pt[pte_index]);
+        }
+    }
+    
+    // 区域被释放后留下的页表虽已没有映射, 也要回收, 检查页目录项只需读一页
+    // 同样先在关中断下清空页目录项再归还页表, 免得换出扫描把已归还的页框当作页表访问
+    unsigned int *pde = pde_ptr(0);
+    for(pde_index = 0; pde_index < 768; pde_index++)
+    {
+        if(pde[pde_index] & PG_P_1)
+        {
+            enum intr_status old_status = intr_disable();
+            unsigned int pt_phyaddr = pde[pde_index] & 0xfffff000;
+            pde[pde_index] = 0;
+            pfree(pt_phyaddr);
+            intr_set_status(old_status);
+        }
+    }
+    tlb_flush_all();
+}
+
+
+
+
+/***** 页面换出 swap *****/
+
+/* 时钟(clock)算法的指针: 下次从pid为clock_pid的进程用户空间中的clock_vaddr处接着扫描
+ * 所有进程的用户页排成一圈, 指针扫过访问位为1的页时清掉访问位, 扫到访问位为0的页就换出,
+ * 指针转一圈仍未被访问过的页才会被换出 */
+static signed short int clock_pid = -1;
+static unsigned int clock_vaddr;
+
+
+/* 用户内存池用完时腾出一页: 先释放映像缓存中没有进程在用的页, 它们不用写盘; 
+ * 没有这样的页再换出一页不常用的用户页. 腾出了一页返回true */
+static bool user_page_reclaim(void)
+{
+    return image_cache_reclaim() || swap_out_page();
+}
+
+
+/* 从用户内存池分配一页, 用户内存池和可借的页框都用完时, 腾出一页后重试
+ * zeroed不为NULL时优先取预清0的页框, 并通过它告知该页是否已清0. 失败返回NULL */
+static void *palloc_user(bool *zeroed)
+{
+    void *page_phyaddr;
+    do
+    {
+        page_phyaddr = zeroed != NULL ? palloc_zeroed(&user_pool, zeroed) : palloc(&user_pool);
+    } while(page_phyaddr == NULL && user_page_reclaim());
+    return page_phyaddr;
+}
+
+
+/* 页表项pte映射的是否是可换出的页: 独占的私有用户页
+ * 零页、写时复制共享着的页和共享映射的页都要被多方共用, 不换出 */
+static bool pte_swappable(unsigned int pte)
+{
+    return (pte & (PG_P_1 | PG_US_U | PG_SHARED)) == (PG_P_1 | PG_US_U) && \
+           (pte >> 12) != zero_page_pfn && mem_map[pte >> 12].ref_count == 1;
+}
+
+
+/* 从clock_vaddr起扫描任务pthread的用户空间, 找一页可换出的页换出到交换槽slot
+ * 找到时页的内容复制到swap_buf中, 页表项改为指向交换槽, 页框归还, 返回true
+ * 调用者需关中断并持有swap_lock */
+static bool clock_scan(struct task_struct *pthread, unsigned int slot)
+{
+    // 任务的页目录正在cr3中时, 改动页表项后要作废TLB中的旧条目; 否则切换cr3时自会清掉
+    unsigned int cr3;
+    asm volatile("movl %%cr3, %0" : "=r" (cr3));
+    bool active = (cr3 & 0xfffff000) == addr_v2p((unsigned int)pthread->pgdir);
+    
+    unsigned int vaddr = clock_vaddr;
+    while(vaddr < 0xc0000000)
+    {
+        unsigned int pde = pthread->pgdir[PDE_IDX(vaddr)];
+        if(!(pde & PG_P_1))
+        {
+            vaddr = (vaddr & 0xffc00000) + 0x400000;
+            continue;
+        }
+        
+        // 别的进程的页表没有映射在当前地址空间中, 借临时映射窗口访问
+        unsigned int *pt = kmap_atomic(pde & 0xfffff000);
+        do
+        {
+            unsigned int *pte = &pt[PTE_IDX(vaddr)];
+            if(pte_swappable(*pte) && (*pte & PG_A))
+            {
+                // 最近访问过, 清掉访问位再放过一次
+                *pte &= ~PG_A;
+                if(active)
+                    tlb_flush_page(vaddr);
+            }
+            else if(pte_swappable(*pte))
+            {
+                unsigned int page_phyaddr = *pte & 0xfffff000;
+                void *page = kmap_atomic(page_phyaddr);
+                memcpy(swap_buf, page, PAGE_SIZE);
+                kunmap_atomic(page);
+                
+                // 页表项的P位清0, 换入时按保留下来的属性位重建映射
+                *pte = (slot << 12) | (*pte & (PG_US_U | PG_RW_W | PG_COW)) | PG_SWAPPED;
+                kunmap_atomic(pt);
+                if(active)
+                    tlb_flush_page(vaddr);
+                pfree(page_phyaddr);
+                
+                clock_pid = pthread->pid;
+                clock_vaddr = vaddr + PAGE_SIZE;
+                return true;
+            }
+            vaddr += PAGE_SIZE;
+        } while(PTE_IDX(vaddr) != 0);
+        kunmap_atomic(pt);
+    }
+    return false;
+}
+
+
+/* 按时钟算法从所有进程的用户页中换出一页到交换分区, 腾出一个页框
+ * 成功返回true; 未启用交换、交换分区已满或没有可换出的页时返回false */
+static bool swap_out_page(void)
+{
+    if(swap_free_slots() == 0)
+        return false;
+    
+    lock_acquire(&swap_lock);
+    enum intr_status old_status = intr_disable();
+    signed int slot = swap_slot_alloc();
+    if(slot == -1)
+    {
+        intr_set_status(old_status);
+        lock_release(&swap_lock);
+        return false;
+    }
+    
+    // 从指针所在的进程接着扫描, 该进程已退出则从头开始
+    struct list_elem *elem = thread_all_list.head.next;
+    while(elem != &thread_all_list.tail && \
+          (elem2entry(struct task_struct, all_list_tag, elem))->pid != clock_pid)
+        elem = elem->next;
+    if(elem == &thread_all_list.tail)
+    {
+        elem = thread_all_list.head.next;
+        clock_vaddr = 0;
+    }
+    
+    // 第一圈清掉访问位, 第二圈必能找到没被访问过的页, 转过两圈仍没有则是没有可换出的页
+    unsigned int visits = 2 * (list_len(&thread_all_list) + 1);
+    bool found = false;
+    while(!found && visits-- > 0)
+    {
+        struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, elem);
+        // 内核线程没有用户空间
+        if(pthread->pgdir != NULL)
+            found = clock_scan(pthread, slot);
+        if(!found)
+        {
+            elem = elem->next == &thread_all_list.tail ? thread_all_list.head.next : elem->next;
+            clock_vaddr = 0;
+        }
+    }
+    intr_set_status(old_status);
+    
+    // 页框已归还, 页的内容在swap_buf中, 写盘时持有swap_lock, 换入该槽的一方会等写完
+    if(found)
+        swap_slot_write(slot, swap_buf);
+    else
+        swap_slot_put(slot);
+    lock_release(&swap_lock);
+    return found;
+}
+
+
+/* 当前进程用户空间中vaddr所在的页是否已被换出 */
+static bool page_swapped(unsigned int vaddr)
+{
+    return (*pde_ptr(vaddr) & PG_P_1) && (*pte_ptr(vaddr) & (PG_P_1 | PG_SWAPPED)) == PG_SWAPPED;
+}
+
+
+/* 把当前进程中已换出的vaddr所在页换入, 换入后其交换槽的引用数减1. 成功返回true */
+static bool swap_in_page(unsigned int vaddr)
+{
+    vaddr &= 0xfffff000;
+    lock_acquire(&swap_lock);
+    
+    // 分配页框时可能要先换出别的页, 换出只动映射着页框的页表项, 本页的页表项不会变
+    void *page_phyaddr = palloc_user(NULL);
+    if(page_phyaddr == NULL)
+    {
+        lock_release(&swap_lock);
+        return false;
+    }
+    
+    // 先以可写方式映射新页框, 直接把交换槽的内容读到vaddr处, 读盘时持有swap_lock, 此页不会被换出
+    unsigned int *pte = pte_ptr(vaddr);
+    unsigned int swap_pte = *pte, slot = swap_pte >> 12;
+    *pte = (unsigned int)page_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+    swap_slot_read(slot, (void *)vaddr);
+    
+    *pte = (unsigned int)page_phyaddr | (swap_pte & (PG_US_U | PG_RW_W | PG_COW)) | PG_P_1;
+    tlb_flush_page(vaddr);
+    swap_slot_put(slot);
+    
+    lock_release(&swap_lock);
+    return true;
+}
+
+
+
+
+
+
+/***** 实现 sys_malloc 小内存申请 16 32 64 128 256 512 1024*****/
+
+
+/* 返回arena中第index个内存块的地址 */
+static struct mem_block *arena2block(struct arena *ar, unsigned int index)
+{
+    return (struct mem_block *) \
+           ((unsigned int)ar + sizeof(struct arena) + index * ar->desc->block_size);
+}
+
+
+/* 返回内存块block所在的arena地址 */
+static struct arena *block2arena(struct mem_block *bk)
+{
+    // mem_block 是在页框的基础上做的细分, &0xffff_f000 即得到对应页框的基地址
+    return (struct arena *) ((unsigned int)bk & 0xfffff000);
+}
+
+
+
+
+/* 从规格desc中取一个内存块, 没有空闲块时新建一个arena, 失败返回NULL
+ * 优先从partial_list队首, 即较满的arena中取, 让空闲块集中到少数arena中以便整页释放
+ * 调用者需持有相应内存池的锁 */
+static struct mem_block *block_get(enum pool_flags PF, struct mem_block_desc *desc, unsigned int desc_index)
+{
+    struct arena *ar;
+    struct mem_block *bk;
+    
+    // 若没有还有空闲块的arena, 则创建新的arena提供mem_block
+    if(list_empty(&desc->partial_list))
+    {
+        ar = malloc_page(PF, 1);    // 分配一页框作为arena
+        if(ar == NULL)
+            return NULL;
+        
+        // 对于分配的小块内存, 将desc置为相应内存块描述符, 
+        // count置为此arena可用的内存块数, large置为false
+        // 内存块在分配给调用者时才清0, 这里不必清0整页
+        ar->desc = desc;
+        ar->large = false;
+        ar->count = desc->blocks_per_arena;
+        ar->desc_index = desc_index;
+        list_init(&ar->free_list);
+        
+        // 开始将arena拆分成内存块, 并添加到arena自己的free_list
+        unsigned int block_index;
+        for(block_index = 0; block_index < desc->blocks_per_arena; block_index++)
+        {
+            bk = arena2block(ar, block_index);
+            list_append(&ar->free_list, &bk->free_elem);
+        }
+        // 全空的arena放在队尾, 最后才用
+        list_append(&desc->partial_list, &ar->partial_tag);
+        desc->arena_count++;
+    }
+    
+    ar = elem2entry(struct arena, partial_tag, desc->partial_list.head.next);
+    bk = elem2entry(struct mem_block, free_elem, list_pop(&ar->free_list));
+    
+    // 将此arena中的空闲内存块数减1, 分配完了就移出partial_list
+    if(--ar->count == 0)
+        list_remove(&ar->partial_tag);
+    return bk;
+}
+
+
+/* 把内存块bk归还到其arena中, 若此arena中的内存块都空闲了就释放arena
+ * descs为当前任务所用的内存块描述符数组
+ * 调用者需持有相应内存池的锁 */
+static void block_put(enum pool_flags PF, struct mem_block_desc *descs, struct mem_block *bk)
+{
+    struct arena *ar = block2arena(bk);
+    struct mem_block_desc *desc = &descs[ar->desc_index];
+    
+    // fork出的子进程中, 从父进程复制来的arena仍关联着父进程的块描述符, 其链表结点也是父进程的.
+    // 不能去动这些结点, 直接把arena收归当前任务的块描述符, 视作不在任何partial_list中
+    if(ar->desc != desc)
+    {
+        ar->desc = desc;
+        if(ar->count > 0)
+            list_push(&desc->partial_list, &ar->partial_tag);
+    }
+    
+    // 先将内存块回收到arena的free_list
+    list_push(&ar->free_list, &bk->free_elem);
+    
+    // 原来已分配完的arena, 现在又有了空闲块, 放到partial_list队首优先使用
+    if(ar->count++ == 0)
+        list_push(&desc->partial_list, &ar->partial_tag);
+    
+    // 此 arena 中的内存块都空闲了, 就释放arena
+    if(ar->count == desc->blocks_per_arena)
+    {
+        list_remove(&ar->partial_tag);
+        mfree_page(PF, ar, 1);  // 释放此arena
+        desc->arena_count--;
+    }
+}
+
+
+/* 弹匣为空时, 从规格descs[desc_index]中批量取MAGAZINE_BATCH个内存块装入弹匣, 弹匣仍为空则返回false */
+static bool magazine_refill(struct mem_magazine *mag, enum pool_flags PF, struct pool *mem_pool, \
+                            struct mem_block_desc *descs, unsigned int desc_index)
+{
+    lock_acquire(&mem_pool->lock);
+    while(mag->count < MAGAZINE_BATCH)
+    {
+        struct mem_block *bk = block_get(PF, &descs[desc_index], desc_index);
+        if(bk == NULL)
+            break;
+        mag->blocks[mag->count++] = bk;
+    }
+    lock_release(&mem_pool->lock);
+    return mag->count > 0;
+}
+
+
+/* 把弹匣中最早放入的drain_count个内存块批量归还给内存池, descs为任务所用的内存块描述符数组 */
+static void magazine_drain(struct mem_magazine *mag, enum pool_flags PF, struct pool *mem_pool, \
+                           struct mem_block_desc *descs, unsigned int drain_count)
+{
+    unsigned int index;
+    ASSERT(drain_count <= mag->count);
+    
+    lock_acquire(&mem_pool->lock);
+    for(index = 0; index < drain_count; index++)
+        block_put(PF, descs, mag->blocks[index]);
+    lock_release(&mem_pool->lock);
+    
+    // 剩下的内存块移到弹匣底部
+    for(index = drain_count; index < mag->count; index++)
+        mag->blocks[index - drain_count] = mag->blocks[index];
+    mag->count -= drain_count;
+}
+
+
+/* 内核线程退出时, 把其弹匣中缓存的内核内存块全部归还给内核内存池
+ * 用户进程的弹匣缓存的是进程自己堆中的内存块, 随地址空间一并回收, 不必归还 */
+void mem_magazines_drain(struct task_struct *pthread)
+{
+    ASSERT(pthread->pgdir == NULL);
+    unsigned int desc_index;
+    for(desc_index = 0; desc_index < MEM_DESC_COUNT; desc_index++)
+    {
+        struct mem_magazine *mag = &pthread->mem_magazines[desc_index];
+        if(mag->count > 0)
+            magazine_drain(mag, PF_KERNEL, &kernel_pool, k_block_descs, mag->count);
+    }
+}
 
 
 /* 在堆中申请size字节内存 */
-void *sys_malloc(unsigned int size)
+// 小内存块优先从当前任务的弹匣中取, 不用获取内存池的锁
+static void *__sys_malloc(unsigned int size)
 {
     enum pool_flags PF;
     struct pool *mem_pool;
-    unsigned int pool_size;
     struct mem_block_desc *descs;
+    struct mem_large_stat *large_stat;
     
     struct task_struct *current_thread = running_thread();
     
@@ -507,25 +1689,24 @@ void *sys_malloc(unsigned int size)
     if(current_thread->pgdir == NULL)   // 若为内核线程
     {
         PF = PF_KERNEL;
-        pool_size = kernel_pool.pool_size;
         mem_pool = &kernel_pool;
         descs = k_block_descs;
+        large_stat = &k_large_stat;
     }
     else    // 用户进程PCB中的pgdir会在为其分配页表时创建
     {
         PF = PF_USER;
-        pool_size = user_pool.pool_size;
         mem_pool = &user_pool;
         descs = current_thread->u_block_desc;
+        large_stat = &current_thread->u_large_stat;
     }
     
-    // 若申请的内存不在内存池容量范围内, 则直接返回NULL
-    if(!(size > 0 && size < pool_size))
+    // 若申请的内存不在内存池容量范围内, 则直接返回NULL. 内存池之间可以互借, 容量按两者之和算
+    if(!(size > 0 && size < kernel_pool.pool_size + user_pool.pool_size))
         return NULL;
     
     struct arena *ar;
     struct mem_block *bk;
-    lock_acquire(&mem_pool->lock);
     
     // 超过最大内存块1024, 就直接分配4KB页
     // 本项目中支持7种规格: 16 32 64 128 256 512 1024
@@ -533,15 +1714,25 @@ void *sys_malloc(unsigned int size)
         // 向上取整需要的页框数
         unsigned page_count = \
             DIV_ROUND_UP(size + sizeof(struct arena), PAGE_SIZE);
-            
-        ar= malloc_page(PF, page_count);
-        if(ar != NULL)  // 前12字节的元信息结构也将被清0
-            memset(ar, 0, page_count * PAGE_SIZE);
+        
+        // 用户进程的大块内存按需分配页框, 没用到的页不占物理内存
+        lock_acquire(&mem_pool->lock);
+        if(PF == PF_USER)
+            ar = malloc_user_pages_lazy(page_count);
+        else
+            ar = __malloc_page(PF, page_count, true);   // 已清0, 包括arena元信息
+        if(ar == NULL)
+        {
+            lock_release(&mem_pool->lock);
+            return NULL;
+        }
         
         // 对于分配的大页框, 将desc置为NULL, count为页框数, large置为true
         ar->desc = NULL;
         ar->count = page_count;
         ar->large = true;
+        large_stat->count++;
+        large_stat->pages += page_count;
         lock_release(&mem_pool->lock);
         
         // 跨过arena大小, 把剩下的内存返回
@@ -558,49 +1749,29 @@ void *sys_malloc(unsigned int size)
                 break;
         }
         
-        // 若 mem_block_desc 的 free_list中没有可用的 mem_block, 则创建新的arena提供mem_block
-        if(list_empty(&descs[desc_index].free_list))
-        {
-            ar = malloc_page(PF, 1);    // 分配一页框作为arena
-            if(ar == NULL)
-            {
-                lock_release(&mem_pool->lock);
-                return NULL;
-            }
-            memset(ar, 0, PAGE_SIZE);
-            
-            // 对于分配的小块内存, 将desc置为相应内存块描述符, 
-            // count置为此arena可用的内存块数, large置为false
-            ar->desc = &descs[desc_index];
-            ar->large = false;
-            ar->count = descs[desc_index].blocks_per_arena;
-            unsigned int block_index;
-            
-            enum intr_status old_status = intr_disable();   // 关中断
-            
-            // 开始将arena拆分成内存块, 并添加到内存块描述符的free_list
-            for(block_index = 0; block_index < descs[desc_index].blocks_per_arena; block_index++)
-            {
-                bk = arena2block(ar, block_index);
-                ASSERT(!elem_find(&ar->desc->free_list, &bk->free_elem));
-                list_append(&ar->desc->free_list, &bk->free_elem);
-            }
-            intr_set_status(old_status);
-        }
+        // 弹匣是当前任务私有的, 存取时不必加锁. 弹匣空了才加锁批量补充
+        struct mem_magazine *mag = &current_thread->mem_magazines[desc_index];
+        if(mag->count == 0 && !magazine_refill(mag, PF, mem_pool, descs, desc_index))
+            return NULL;
         
         // 开始分配内存块
-        bk = elem2entry(struct mem_block, free_elem, list_pop(&(descs[desc_index].free_list)));
+        bk = mag->blocks[--mag->count];
         memset(bk, 0, descs[desc_index].block_size);    // 这里也会覆盖内存块中 struct list_elem free_elem 变量
-        
-        ar = block2arena(bk);   // 获取内存块bk所在的arena
-        ar->count--;            // 将此arena中的空闲内存块数减1
-        
-        lock_release(&mem_pool->lock);
         return (void *)bk;
     }
 }
 
 
+/* 在堆中申请size字节内存, 返回的内存已清0 */
+void *sys_malloc(unsigned int size)
+{
+    void *vaddr = __sys_malloc(size);
+    if(vaddr != NULL)
+        heap_profile_alloc(__builtin_return_address(0), vaddr, size);
+    return vaddr;
+}
+
+
 
 
 
@@ -609,36 +1780,23 @@ void *sys_malloc(unsigned int size)
 /* 将物理地址 pg_phy_addr 回收到物理内存池 */
 static void pfree(unsigned int pg_phy_addr)
 {
-    struct pool *mem_pool;
-    unsigned int bit_index = 0;
+    unsigned int pfn = pg_phy_addr / PAGE_SIZE;
+    ASSERT(pfn < mem_map_count);
     
-    // 本项目中物理内存配置为32M, 减去起始的2M, 内核/用户各占15M物理内存
-    // 其中低15M分配给内核, 高15M给用户
-    if(pg_phy_addr >= user_pool.phy_addr_begin)     // 用户物理内存池
-    {
-        mem_pool = &user_pool;
-        bit_index = (pg_phy_addr - user_pool.phy_addr_begin) / PAGE_SIZE;
-    }
-    else    // 内核物理内存池
-    {
-        mem_pool = &kernel_pool;
-        bit_index = (pg_phy_addr - kernel_pool.phy_addr_begin) / PAGE_SIZE;
-    }
-    bitmap_set(&mem_pool->pool_bitmap, bit_index, 0);   // 将位图中该位清0
-}
-
-
-/* 去掉页表中虚拟地址 vaddr 的映射, 只去掉 vaddr 对应的pte */
-static void page_table_pte_remove(unsigned int vaddr)
-{
-    unsigned int *pte = pte_ptr(vaddr);
-    *pte &= ~PG_P_1;    // 将页表项pte的P位置0
+    // 页框属于哪个内存池由其物理页描述符记录
+    struct page_desc *page = &mem_map[pfn];
+    ASSERT(page->pool != NULL && !(page->flags & (PD_BUDDY | PD_RESERVED | PD_ZEROED)));
+    
+    // 零页常驻内存, 解除映射即可
+    if(pfn == zero_page_pfn)
+        return;
     
-    // 刷新快表TLB
-    // 快表 TLB, 页表的高速缓存, TLB是处理器提供的、用于加速虚拟地址到物理地址的转换过程
-    // 更新TLB有2种方式: 1) invlpg指令更新单条虚拟地址条目; 2) 重新加载 cr3, 这将直接清空TLB, 相当于更新整个页表
-    // "m" 内存约束
-    asm volatile("invlpg %0" : : "m" (vaddr) : "memory");   // 更新TLB
+    // 写时复制共享的页框, 最后一个使用者释放时才真正归还
+    enum intr_status old_status = intr_disable();
+    ASSERT(page->ref_count > 0);
+    if(--page->ref_count == 0)
+        buddy_free(page->pool, pfn, 0);
+    intr_set_status(old_status);
 }
 
 
@@ -653,13 +1811,8 @@ static void vaddr_remove(enum pool_flags pf, void *_vaddr, unsigned int page_cou
         while(counting < page_count)
             bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_index_begin + counting++, 0);
     }
-    else    // 用户虚拟内存池
-    {
-        struct task_struct *current_thread = running_thread();
-        bit_index_begin = (vaddr - current_thread->user_vaddr.vaddr_begin) / PAGE_SIZE;
-        while(counting < page_count)
-            bitmap_set(&current_thread->user_vaddr.vaddr_bitmap, bit_index_begin + counting++, 0);
-    }
+    else    // 用户虚拟地址, 从进程的区域链表中去掉
+        vaddr_region_remove(running_thread(), vaddr, page_count);
 }
 
 
@@ -669,88 +1822,78 @@ void mfree_page(enum pool_flags pf, void *_vaddr, unsigned int page_count)
     unsigned int vaddr = (unsigned int)_vaddr, counting = 0;
     ASSERT(page_count >= 1 && vaddr % PAGE_SIZE == 0);
     
-    unsigned int pg_phy_addr = addr_v2p(vaddr);     // 获取虚拟地址 vaddr 对应的物理地址
-    
-    /* 确保待释放的物理内存在 ( 低端1MB内存 + 1KB的页目录 + 1KB的页表 ) 地址范围外 */
-    ASSERT((pg_phy_addr % PAGE_SIZE) == 0 && pg_phy_addr >= 0x102000 ); // 1MB + 1KB + 1KB
+    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+    unsigned int pg_phy_addr, *pte;
     
-    // 判断 pg_phy_addr 属于用户物理内存池还是内核物理内存池
-    // 本项目中物理内存配置为32M, 减去起始的2M, 内核/用户各占15M物理内存
-    // 其中低15M分配给内核, 高15M给用户
-    if(pg_phy_addr >= user_pool.phy_addr_begin)     // 用户物理内存池, 即 user_pool
-    {
-        // 循环处理 page_count 个物理页
-        while(counting < page_count)
-        {
-            // 确保物理地址属于用户物理内存地址
-            ASSERT((pg_phy_addr % PAGE_SIZE) == 0 && pg_phy_addr >= user_pool.phy_addr_begin);
-            
-            // 先将对应的物理页框归还到内存池
-            pfree(pg_phy_addr);
-            
-            // 再从页表中清除此虚拟地址所在的页表项pte
-            page_table_pte_remove(vaddr);
-            
-            vaddr += PAGE_SIZE;
-            pg_phy_addr = addr_v2p(vaddr);
-            
-            counting++;
-        }
-        // 清空虚拟地址的位图中的相应位
-        vaddr_remove(pf, _vaddr, page_count);
-    }
-    else    // 位于kernel_pool内存池
+    // 循环处理 page_count 个物理页
+    while(counting < page_count)
     {
-        while(counting < page_count)
+        // 用户空间中按需分配的页可能从未被访问过, 还没有页表; 页表项则要防着换出扫描同时改动
+        if(pf == PF_USER)
         {
-            // 确保待释放的物理内存只属于内核物理内存池
-            ASSERT((pg_phy_addr % PAGE_SIZE) == 0 && 
-                    pg_phy_addr >= kernel_pool.phy_addr_begin && 
-                    pg_phy_addr < user_pool.phy_addr_begin);
-                    
-            // 先将对应的物理页框归还到内存池
-            pfree(pg_phy_addr);
-            
-            // 再从页表中清除此虚拟地址所在的页表项pte
-            page_table_pte_remove(vaddr);
-            
+            if(*pde_ptr(vaddr) & PG_P_1)
+                user_pte_release(pte_ptr(vaddr));
             vaddr += PAGE_SIZE;
-            pg_phy_addr = addr_v2p(vaddr);
-            
             counting++;
+            continue;
         }
-        // 清空虚拟地址的位图中的相应位
-        vaddr_remove(pf, _vaddr, page_count);
+        
+        pte = pte_ptr(vaddr);
+        pg_phy_addr = *pte & 0xfffff000;    // 页表项中即是 vaddr 对应的物理页框地址
+        
+        /* 确保待释放的物理内存在 ( 低端1MB内存 + 1KB的页目录 + 1KB的页表 ) 地址范围外,
+         * 且属于pf对应的物理内存池 */
+        ASSERT(pg_phy_addr >= 0x102000); // 1MB + 1KB + 1KB
+        ASSERT(mem_map[pg_phy_addr / PAGE_SIZE].pool == mem_pool);
+        
+        // 先将页表项pte的P位置0, TLB留到最后统一刷新
+        *pte &= ~PG_P_1;
+        
+        // 再将对应的物理页框归还到内存池
+        pfree(pg_phy_addr);
+        
+        vaddr += PAGE_SIZE;
+        counting++;
     }
+    // 快表 TLB, 页表的高速缓存. 在虚拟地址还给位图前刷新, 之后这些地址才可能被重新映射
+    tlb_flush_range((unsigned int)_vaddr, page_count);
+    
+    // 清空虚拟地址的位图中的相应位
+    vaddr_remove(pf, _vaddr, page_count);
 }
 
 
 /* 回收内存, 释放vaddr指向的内存 */
-// 释放大内存, 把页框在虚拟内存池和物理内存池的位图中将相应位置0
-// 回收小内存，将arena中的内存块重新放回到内存块描述符中的空闲块链表free_list
-void sys_free(void *vaddr)
+// 释放大内存, 把页框在虚拟内存池和物理内存池中归还
+// 回收小内存, 先放入当前任务的弹匣, 弹匣满了再批量放回各自arena的空闲块链表free_list
+static void __sys_free(void *vaddr)
 {
     ASSERT(vaddr != NULL);
     if(vaddr != NULL)
     {
         enum pool_flags PF;
         struct pool *mem_pool;
+        struct mem_block_desc *descs;
+        struct mem_large_stat *large_stat;
+        struct task_struct *current_thread = running_thread();
         
         // 判断是线程还是进程
-        if(running_thread()->pgdir == NULL)     // 线程
+        if(current_thread->pgdir == NULL)     // 线程
         {
             ASSERT((unsigned int)vaddr >= K_HEAP_START);
             PF = PF_KERNEL;
             mem_pool = &kernel_pool;
+            descs = k_block_descs;
+            large_stat = &k_large_stat;
         }
         else
         {
             PF = PF_USER;
             mem_pool = &user_pool;
+            descs = current_thread->u_block_desc;
+            large_stat = &current_thread->u_large_stat;
         }
         
-        lock_acquire(&mem_pool->lock);
-        
         // 把 mem_block 转换为 arena, 获取元信息
         struct mem_block *bk = vaddr;
         struct arena *ar = block2arena(bk);
@@ -758,45 +1901,224 @@ void sys_free(void *vaddr)
         ASSERT(ar->large == 0 || ar->large == 1);
         
         if(ar->desc == NULL && ar->large == true)   // 大于1024的大内存
+        {
+            lock_acquire(&mem_pool->lock);
+            // 用户进程大块内存中首页之后的部分是按需分配的匿名区域
+            struct vm_area *area = NULL;
+            if(PF == PF_USER && ar->count > 1)
+                area = vm_area_find(current_thread, (unsigned int)ar + PAGE_SIZE);
+            if(area != NULL)
+                vm_area_destroy(area);
+            large_stat->count--;
+            large_stat->pages -= ar->count;
             mfree_page(PF, ar, ar->count);
+            lock_release(&mem_pool->lock);
+        }
         else    // 小于等于1024的小内存块
         {
-            // 先将内存块回收到 free_list
-            list_append(&ar->desc->free_list, &bk->free_elem);
-            
-            // 再判断此 arena 中的内存块是否都是空闲, 如果是就释放arena
-            if(++ar->count == ar->desc->blocks_per_arena)
-            {
-                unsigned int block_index;
-                // for循环, 将此arena中所有的内存块从对应的内存块描述符的free_list中去掉
-                for(block_index = 0; block_index < ar->desc->blocks_per_arena; block_index++)
-                {
-                    struct mem_block *bk = arena2block(ar, block_index);
-                    ASSERT(elem_find(&ar->desc->free_list, &bk->free_elem));
-                    list_remove(&bk->free_elem);
-                }
-                mfree_page(PF, ar, 1);  // 释放此arena
-            }
+            // 弹匣满了, 先把其中较早放入的一批内存块归还, 再放入此内存块
+            ASSERT(ar->desc_index < MEM_DESC_COUNT);
+            struct mem_magazine *mag = &current_thread->mem_magazines[ar->desc_index];
+            if(mag->count == MAGAZINE_SIZE)
+                magazine_drain(mag, PF, mem_pool, descs, MAGAZINE_BATCH);
+            mag->blocks[mag->count++] = bk;
         }
-        lock_release(&mem_pool->lock);
     }
 }
 
 
-/* 根据物理页框地址 page_phy_addr 在相应的内存池的位图清0, 不改动页表 */
-void free_a_phy_page(unsigned int page_phy_addr)
+/* 释放sys_malloc得到的内存vaddr */
+void sys_free(void *vaddr)
 {
+    heap_profile_free(vaddr);
+    __sys_free(vaddr);
+}
+
+
+/* 尝试就地把vaddr处的内存调整为size字节, 成功返回true
+ * 小内存块的规格容得下size即可; 大块缩小时释放尾部的页, 扩大时不就地扩展, 由调用者复制
+ * 不能就地调整时返回false, 并在capacity中返回原内存可用的字节数 */
+static bool heap_resize(void *vaddr, unsigned int size, unsigned int *capacity)
+{
+    enum pool_flags PF;
     struct pool *mem_pool;
-    unsigned int bit_index = 0;
-    if(page_phy_addr >= user_pool.phy_addr_begin)
+    struct mem_block_desc *descs;
+    struct mem_large_stat *large_stat;
+    struct task_struct *current_thread = running_thread();
+    
+    if(current_thread->pgdir == NULL)
     {
-        mem_pool = &user_pool;
-        bit_index = (page_phy_addr - user_pool.phy_addr_begin) / PAGE_SIZE;
+        PF = PF_KERNEL;
+        mem_pool = &kernel_pool;
+        descs = k_block_descs;
+        large_stat = &k_large_stat;
     }
     else
     {
-        mem_pool = &kernel_pool;
-        bit_index = (page_phy_addr - kernel_pool.phy_addr_begin) / PAGE_SIZE;
+        PF = PF_USER;
+        mem_pool = &user_pool;
+        descs = current_thread->u_block_desc;
+        large_stat = &current_thread->u_large_stat;
     }
-    bitmap_set(&mem_pool->pool_bitmap, bit_index, 0);
+    
+    struct arena *ar = block2arena(vaddr);
+    if(!ar->large)
+    {
+        *capacity = descs[ar->desc_index].block_size;
+        return size <= *capacity;
+    }
+    
+    *capacity = ar->count * PAGE_SIZE - sizeof(struct arena);
+    unsigned int page_count = DIV_ROUND_UP(size + sizeof(struct arena), PAGE_SIZE);
+    if(page_count > ar->count)
+        return false;
+    
+    // 截去尾部不必拆分区域, 不会失败
+    unsigned int old_end = (unsigned int)ar + ar->count * PAGE_SIZE;
+    unsigned int new_end = (unsigned int)ar + page_count * PAGE_SIZE;
+    lock_acquire(&mem_pool->lock);
+    if(page_count < ar->count)
+    {
+        if(PF == PF_USER)
+            vm_area_remove_range(current_thread, new_end, old_end);
+        mfree_page(PF, (void *)new_end, ar->count - page_count);
+        large_stat->pages -= ar->count - page_count;
+    }
+    ar->count = page_count;
+    lock_release(&mem_pool->lock);
+    return true;
+}
+
+
+/* 把vaddr处的内存调整为size字节, 返回调整后的地址, 原有内容保持不变, 扩大的部分内容不确定
+ * vaddr为NULL时等同于sys_malloc, size为0时等同于sys_free并返回NULL
+ * 缩小或仍在原规格内时不移动内存, 否则申请新内存并复制; 失败返回NULL, 原内存不受影响 */
+void *sys_realloc(void *vaddr, unsigned int size)
+{
+    if(vaddr == NULL)
+    {
+        vaddr = __sys_malloc(size);
+        if(vaddr != NULL)
+            heap_profile_alloc(__builtin_return_address(0), vaddr, size);
+        return vaddr;
+    }
+    if(size == 0)
+    {
+        sys_free(vaddr);
+        return NULL;
+    }
+    // 大块要按size加上arena元信息向上取整算页数, 这里先排除算页数时会溢出的size
+    if(size > 0xffffffff - sizeof(struct arena) - (PAGE_SIZE - 1))
+        return NULL;
+    
+    unsigned int capacity;
+    void *new_vaddr = vaddr;
+    if(!heap_resize(vaddr, size, &capacity))
+    {
+        new_vaddr = __sys_malloc(size);
+        if(new_vaddr == NULL)
+            return NULL;
+        memcpy(new_vaddr, vaddr, capacity < size ? capacity : size);
+        __sys_free(vaddr);
+    }
+    heap_profile_free(vaddr);
+    heap_profile_alloc(__builtin_return_address(0), new_vaddr, size);
+    return new_vaddr;
+}
+
+
+/* 根据物理页框地址 page_phy_addr 将其归还到所属内存池的伙伴系统, 不改动页表 */
+void free_a_phy_page(unsigned int page_phy_addr)
+{
+    pfree(page_phy_addr);
+}
+
+
+
+/***** 内存统计 *****/
+
+/* 统计内存池mem_pool的使用情况, 调用者需关中断 */
+static void pool_info_get(struct pool *mem_pool, struct pool_info *info)
+{
+    info->total_pages = mem_pool->pool_size / PAGE_SIZE;
+    info->free_pages = mem_pool->free_pages;
+    info->zero_pages = mem_pool->zero_pages;
+    
+    // 预清0的页框也是空闲的单页
+    info->largest_free_pages = mem_pool->zero_pages > 0 ? 1 : 0;
+    signed int order;
+    for(order = MAX_ORDER - 1; order >= 0; order--)
+    {
+        if(!list_empty(&mem_pool->free_area[order]))
+        {
+            info->largest_free_pages = 1u << order;
+            break;
+        }
+    }
+}
+
+
+/* 统计内存块描述符数组descs中各规格的arena数及空闲内存块数, 调用者需关中断
+ * fork出的子进程从父进程继承的arena, 在子进程用到之前不在其partial_list中, 其空闲块不计入 */
+static void block_info_get(struct mem_block_desc *descs, struct block_class_info *info)
+{
+    unsigned int desc_index;
+    for(desc_index = 0; desc_index < MEM_DESC_COUNT; desc_index++)
+    {
+        info[desc_index].block_size = descs[desc_index].block_size;
+        info[desc_index].arenas = descs[desc_index].arena_count;
+        
+        struct list_elem *elem = descs[desc_index].partial_list.head.next;
+        while(elem != &descs[desc_index].partial_list.tail)
+        {
+            info[desc_index].free_blocks += (elem2entry(struct arena, partial_tag, elem))->count;
+            elem = elem->next;
+        }
+    }
+}
+
+
+/* 把任务pthread的弹匣中缓存的内存块数计入info */
+static void magazine_info_add(struct task_struct *pthread, struct block_class_info *info)
+{
+    unsigned int desc_index;
+    for(desc_index = 0; desc_index < MEM_DESC_COUNT; desc_index++)
+        info[desc_index].cached_blocks += pthread->mem_magazines[desc_index].count;
+}
+
+
+/* 统计各内存池、内核堆及当前进程堆的使用情况, 存入info. 成功返回0 */
+signed int sys_meminfo(struct mem_info *info)
+{
+    // 先在内核栈上统计, 开中断后再一次复制给调用者, 免得关中断期间写用户缓冲区引起缺页
+    struct mem_info stat;
+    memset(&stat, 0, sizeof(stat));
+    struct task_struct *current = running_thread();
+    
+    enum intr_status old_status = intr_disable();
+    pool_info_get(&kernel_pool, &stat.kernel);
+    pool_info_get(&user_pool, &stat.user);
+    
+    // 内核堆的内存块还缓存在各内核线程的弹匣中
+    block_info_get(k_block_descs, stat.kernel_blocks);
+    struct list_elem *elem = thread_all_list.head.next;
+    while(elem != &thread_all_list.tail)
+    {
+        struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, elem);
+        if(pthread->pgdir == NULL)
+            magazine_info_add(pthread, stat.kernel_blocks);
+        elem = elem->next;
+    }
+    stat.kernel_large = k_large_stat;
+    
+    if(current->pgdir != NULL)
+    {
+        block_info_get(current->u_block_desc, stat.user_blocks);
+        magazine_info_add(current, stat.user_blocks);
+        stat.user_large = current->u_large_stat;
+    }
+    intr_set_status(old_status);
+    
+    memcpy(info, &stat, sizeof(stat));
+    return 0;
 }
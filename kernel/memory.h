@@ -17,6 +17,12 @@ enum pool_flags {
 #define	 PG_RW_W  2	// R/W 属性位值, 读/写/执行
 #define	 PG_US_S  0	// U/S 属性位值, 系统级，只允许特权级0 1 2程序访问此页
 #define	 PG_US_U  4	// U/S 属性位值, 用户级，允许所有特权级程序访问此页
+#define	 PG_A     0x20	// 访问位, CPU访问该页时置1
+#define	 PG_D     0x40	// 脏位, CPU写该页时置1
+#define	 PG_G     0x100	// 全局页, 重新加载cr3时TLB中的该条目不会被清掉
+#define	 PG_COW   0x200	// 页表项中留给软件用的第9位, 1表示该页是写时复制页
+#define	 PG_SHARED 0x400	// 留给软件用的第10位, 1表示该页属于共享映射, fork时不做写时复制
+#define	 PG_SWAPPED 0x800	// 留给软件用的第11位, P为0时表示该页已换出, 高20位是交换槽号
 
 
 
@@ -30,20 +36,45 @@ struct virtual_addr{
 
 // extern struct pool kernel_pool, user_pool;
 
+
+/* 伙伴系统的阶数上限, 空闲块大小为 2^0 ~ 2^(MAX_ORDER-1) 页, 即4KB ~ 4MB */
+#define MAX_ORDER   11
+
+#define PD_BUDDY    1   // 该页是伙伴系统中某个空闲块的首页
+#define PD_RESERVED 2   // 该页不归伙伴系统管理, 如低端1MB、页表以及mem_map自身
+#define PD_ZEROED   4   // 该页已预先清0, 挂在所属内存池的zero_list中
+
+/* 物理页描述符, 每个物理页框对应一个, 以页框号pfn为下标存放在mem_map中 */
+struct page_desc{
+    struct list_elem free_tag;  // 空闲块首页用此结点挂在所属内存池的free_area[order]或zero_list链表中
+    unsigned char order;        // 空闲块首页记录该块的阶, 即块大小为 2^order 页
+    unsigned char flags;        // PD_BUDDY / PD_RESERVED / PD_ZEROED
+    unsigned short ref_count;   // 使用该页框的个数, 写时复制共享的用户页框会大于1
+    struct pool *pool;          // 该页所属的物理内存池, 不归伙伴系统管理的页为NULL
+};
+
 void mem_init(void);
 
 
 void *get_kernel_pages(unsigned int page_count);
+void free_kernel_pages(void *vaddr, unsigned int page_count);
 void *malloc_page(enum pool_flags pf, unsigned int page_count);
 void *get_a_page(enum pool_flags pf, unsigned int vaddr);
 
 void *get_user_pages(unsigned int page_count);
+void free_user_pages(void *vaddr, unsigned int page_count);
 
 unsigned int *pte_ptr(unsigned int vaddr);
 unsigned int *pde_ptr(unsigned int vaddr);
 
 unsigned int addr_v2p(unsigned int vaddr);
 
+#define KMAP_SLOTS  4   // 临时映射窗口数, 即可同时临时映射的页框数
+void *kmap_atomic(unsigned int page_phyaddr);
+void kunmap_atomic(void *vaddr);
+
+bool zero_page_fill(void);
+
 
 
 /* 内存块 */
@@ -55,31 +86,94 @@ struct mem_block{
 struct mem_block_desc{
     unsigned int block_size;        // 内存块大小
     unsigned int blocks_per_arena;  // 本arena中可容纳此mem_blcok的数量
-    struct list free_list;          // 空闲内存块mem_block链表, 此链表中只添加规格为block_size的内存块
-                                    // 此链表的长度是无限的，可由多个arena提供内存块
+    struct list partial_list;       // 还有空闲内存块的arena链表, 此链表中只添加规格为block_size的arena
+                                    // 刚从满变为不满的arena放在队首, 新建的空arena放在队尾
+    unsigned int arena_count;       // 本规格现有的arena数, 含已分配完的arena
 };
 
 // 本项目中的内存规格大小是以2为底的指数方程来设计的
 // 从16字节起, 分别是16 32 64 128 256 512 1024
 #define MEM_DESC_COUNT  7   // 内存块描述符个数, 即7种规格的内存块
 
+/* 内存块弹匣
+ * 每个任务对每种规格各有一个弹匣, 缓存最近释放的内存块, 
+ * sys_malloc/sys_free 优先在弹匣中存取, 不必获取内存池的锁; 
+ * 弹匣空了或满了才加锁, 一次补充或归还 MAGAZINE_BATCH 个内存块 */
+#define MAGAZINE_SIZE   8   // 弹匣容量
+#define MAGAZINE_BATCH  4   // 每次批量补充/归还的内存块数
+
+struct mem_magazine{
+    unsigned int count;                         // 弹匣中的内存块数
+    struct mem_block *blocks[MAGAZINE_SIZE];    // 栈式存放, blocks[count-1]是最近放入的
+};
+
+/* 大块内存的统计, 超过1024字节的申请直接按页分配, 不属于任何规格 */
+struct mem_large_stat{
+    unsigned int count;     // 尚未释放的大块数
+    unsigned int pages;     // 这些大块占用的页数
+};
+
+
+/***** meminfo系统调用返回的内存统计 *****/
+
+/* 物理内存池的使用情况 */
+struct pool_info{
+    unsigned int total_pages;           // 内存池当前的页框数, 随内存池之间互借而变化
+    unsigned int free_pages;            // 空闲页框数, 含预清0的页框
+    unsigned int zero_pages;            // 预清0的空闲页框数
+    unsigned int largest_free_pages;    // 最大空闲块的页数, 远小于free_pages说明碎片多, 申请连续的页会失败
+};
+
+/* 堆中一种规格内存块的使用情况 */
+struct block_class_info{
+    unsigned int block_size;        // 内存块规格
+    unsigned int arenas;            // 该规格的arena数
+    unsigned int free_blocks;       // 各arena中空闲的内存块数
+    unsigned int cached_blocks;     // 缓存在弹匣中的内存块数, 对堆来说已分配, 实际空闲
+};
+
+struct mem_info{
+    struct pool_info kernel;        // 内核内存池
+    struct pool_info user;          // 用户内存池
+    struct block_class_info kernel_blocks[MEM_DESC_COUNT];  // 内核堆
+    struct mem_large_stat kernel_large;
+    struct block_class_info user_blocks[MEM_DESC_COUNT];    // 当前进程的堆, 内核线程调用时全为0
+    struct mem_large_stat user_large;
+};
+
+struct task_struct;
+
 void block_desc_init(struct mem_block_desc *desc_array);
 void *sys_malloc(unsigned int size);
 void sys_free(void *vaddr);
+void *sys_realloc(void *vaddr, unsigned int size);
+void mem_magazines_drain(struct task_struct *pthread);
+signed int sys_meminfo(struct mem_info *info);
 
 
 /* 释放以虚拟地址vaddr为起始的count个页框 */
 void mfree_page(enum pool_flags pf, void *_vaddr, unsigned int page_count);
 
 
-/* 安装1页大小的vaddr, 专门针对fork时虚拟地址位图无需操作的情况 */
-// 为指定的vaddr分配一物理页, 但无需从虚拟地址内存池中设置位图
-void *get_a_page_without_operate_vaddrbitmap(enum pool_flags pf, unsigned int vaddr);
+/* fork时让子进程与当前进程写时复制地共享用户空间, fork失败时用cow_unshare_user_space撤销 */
+bool cow_share_user_space(unsigned int *child_pgdir);
+void cow_unshare_user_space(unsigned int *child_pgdir);
+/* 释放当前进程用户空间中的所有页框及页表 */
+void release_user_space(void);
+void *map_zeroed_user_page(unsigned int vaddr);
+bool map_zero_page(unsigned int vaddr, bool writable);
+void user_page_write_protect(unsigned int vaddr);
+void user_page_set_shared(unsigned int vaddr);
+unsigned int user_frame_alloc(void);
+void user_frame_get(unsigned int page_phyaddr);
+unsigned int page_ref_count(unsigned int page_phyaddr);
+void map_shared_user_page(unsigned int vaddr, unsigned int page_phyaddr, bool writable);
+bool user_page_clear_dirty(unsigned int vaddr);
 
 
 
 
-/* 根据物理页框地址 page_phy_addr 在相应的内存池的位图清0, 不改动页表 */
+/* 根据物理页框地址 page_phy_addr 将其归还到所属的物理内存池, 不改动页表 */
 void free_a_phy_page(unsigned int page_phy_addr);
 
 
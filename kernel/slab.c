@@ -0,0 +1,157 @@
+#include "slab.h"
+#include "memory.h"
+#include "string.h"
+#include "debug.h"
+
+#define SLAB_END    0xff    // 空闲对象链的结束标记, 所以每个slab最多254个对象
+
+/* slab元信息, 位于slab所在页的起始处
+ * 空闲对象用下标链起来, 链放在元信息之后而不是对象内部, 以免破坏已构造的对象 */
+struct slab{
+    struct kmem_cache *cache;       // 所属的缓存
+    struct list_elem slab_tag;      // 用于挂到缓存的 partial/full/free 链表
+    unsigned short inuse;           // 已分配的对象数
+    unsigned short free_index;      // 第一个空闲对象的下标
+    unsigned char next_free[0];     // next_free[i]为对象i之后的下一个空闲对象的下标
+};
+
+
+/* 返回slab中第index个对象的地址 */
+static void *slab2obj(struct slab *sb, unsigned int index)
+{
+    return (void *)((unsigned int)sb + sb->cache->obj_offset + index * sb->cache->obj_size);
+}
+
+
+/* 返回对象obj所在的slab */
+static struct slab *obj2slab(void *obj)
+{
+    // slab占1页, &0xfffff000 即得到slab的起始地址
+    return (struct slab *)((unsigned int)obj & 0xfffff000);
+}
+
+
+/* 初始化缓存cache, 对象大小为obj_size字节 */
+void kmem_cache_init(struct kmem_cache *cache, const char *name, \
+                     unsigned int obj_size, void (*ctor)(void *obj))
+{
+    ASSERT(strlen(name) < 16);
+    strcpy(cache->name, name);
+    cache->obj_size = DIV_ROUND_UP(obj_size, 4) * 4;
+    cache->ctor = ctor;
+    
+    // 每个对象除本身外, 还要在空闲链中占1字节
+    unsigned int objs = (PAGE_SIZE - sizeof(struct slab)) / (cache->obj_size + 1);
+    if(objs > SLAB_END - 1)
+        objs = SLAB_END - 1;
+    while(DIV_ROUND_UP(sizeof(struct slab) + objs, 4) * 4 + objs * cache->obj_size > PAGE_SIZE)
+        objs--;
+    ASSERT(objs > 0);
+    cache->objs_per_slab = objs;
+    cache->obj_offset = DIV_ROUND_UP(sizeof(struct slab) + objs, 4) * 4;
+    
+    list_init(&cache->slabs_partial);
+    list_init(&cache->slabs_full);
+    list_init(&cache->slabs_free);
+    lock_init(&cache->lock);
+}
+
+
+/* 为缓存新建一个slab, 并构造其中所有对象, 失败返回NULL */
+static struct slab *slab_create(struct kmem_cache *cache)
+{
+    // slab总是从内核内存池分配, 与当前是内核线程还是用户进程无关
+    struct slab *sb = get_kernel_pages(1);
+    if(sb == NULL)
+        return NULL;
+    
+    sb->cache = cache;
+    sb->inuse = 0;
+    sb->free_index = 0;
+    
+    unsigned int obj_index;
+    for(obj_index = 0; obj_index < cache->objs_per_slab; obj_index++)
+    {
+        sb->next_free[obj_index] = obj_index + 1;
+        if(cache->ctor != NULL)
+            cache->ctor(slab2obj(sb, obj_index));
+    }
+    sb->next_free[cache->objs_per_slab - 1] = SLAB_END;
+    return sb;
+}
+
+
+/* 从缓存cache中分配一个对象, 失败返回NULL */
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    struct slab *sb;
+    lock_acquire(&cache->lock);
+    
+    // 优先用部分分配的slab, 其次是空闲的slab, 都没有再新建
+    if(!list_empty(&cache->slabs_partial))
+        sb = elem2entry(struct slab, slab_tag, cache->slabs_partial.head.next);
+    else
+    {
+        if(!list_empty(&cache->slabs_free))
+            sb = elem2entry(struct slab, slab_tag, list_pop(&cache->slabs_free));
+        else
+        {
+            sb = slab_create(cache);
+            if(sb == NULL)
+            {
+                lock_release(&cache->lock);
+                return NULL;
+            }
+        }
+        list_push(&cache->slabs_partial, &sb->slab_tag);
+    }
+    
+    ASSERT(sb->free_index != SLAB_END);
+    void *obj = slab2obj(sb, sb->free_index);
+    sb->free_index = sb->next_free[sb->free_index];
+    
+    // slab已满, 转入full链表
+    if(++sb->inuse == cache->objs_per_slab)
+    {
+        list_remove(&sb->slab_tag);
+        list_push(&cache->slabs_full, &sb->slab_tag);
+    }
+    
+    lock_release(&cache->lock);
+    return obj;
+}
+
+
+/* 将对象obj释放回缓存cache */
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    ASSERT(obj != NULL);
+    struct slab *sb = obj2slab(obj);
+    ASSERT(sb->cache == cache);
+    
+    lock_acquire(&cache->lock);
+    
+    unsigned int obj_index = ((unsigned int)obj - (unsigned int)sb - cache->obj_offset) / cache->obj_size;
+    ASSERT(obj_index < cache->objs_per_slab && sb->inuse > 0);
+    sb->next_free[obj_index] = sb->free_index;
+    sb->free_index = obj_index;
+    
+    // 原来是满的slab, 现在有空闲对象了, 转入partial链表
+    if(sb->inuse-- == cache->objs_per_slab)
+    {
+        list_remove(&sb->slab_tag);
+        list_push(&cache->slabs_partial, &sb->slab_tag);
+    }
+    
+    // slab中对象全部空闲了, 转入free链表. 已有一个空闲slab时, 就把这页还给内核内存池
+    if(sb->inuse == 0)
+    {
+        list_remove(&sb->slab_tag);
+        if(list_empty(&cache->slabs_free))
+            list_push(&cache->slabs_free, &sb->slab_tag);
+        else
+            free_kernel_pages(sb, 1);
+    }
+    
+    lock_release(&cache->lock);
+}
@@ -0,0 +1,30 @@
+#ifndef __KERNEL_SLAB_H
+#define __KERNEL_SLAB_H
+
+#include "list.h"
+#include "sync.h"
+
+/* slab对象缓存
+ * 每种频繁申请释放的内核对象(如inode, dir, io缓冲区)各有一个缓存,
+ * 缓存由若干slab组成, 每个slab占1页内核内存, 被切分成同样大小的对象.
+ * 对象只在slab创建时调用一次构造函数ctor, 因此释放回缓存的对象应保持构造后的状态 */
+struct kmem_cache{
+    char name[16];                  // 缓存名称, 调试用
+    unsigned int obj_size;          // 对象大小, 已按4字节对齐
+    unsigned int objs_per_slab;     // 每个slab中的对象数
+    unsigned int obj_offset;        // 第一个对象相对于slab起始处的偏移
+    void (*ctor)(void *obj);        // 对象构造函数, 可为NULL
+    
+    struct list slabs_partial;      // 部分对象已分配的slab
+    struct list slabs_full;         // 对象全部已分配的slab
+    struct list slabs_free;         // 对象全部空闲的slab, 最多保留1个, 多的还给内核内存池
+    
+    struct lock lock;               // 操作缓存时互斥
+};
+
+void kmem_cache_init(struct kmem_cache *cache, const char *name, \
+                     unsigned int obj_size, void (*ctor)(void *obj));
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+#endif
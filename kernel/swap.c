@@ -0,0 +1,160 @@
+#include "swap.h"
+#include "ide.h"            // struct partition ide_read ide_write
+#include "memory.h"         // get_kernel_pages free_kernel_pages
+#include "interrupt.h"
+#include "string.h"         // strcmp memcmp strlen
+#include "fs.h"             // SECTOR_SIZE
+#include "super_block.h"    // struct super_block
+#include "stdio_kernel.h"   // printk
+#include "debug.h"
+
+#define SECTORS_PER_SLOT    (PAGE_SIZE / 512)   // 每个交换槽的扇区数
+
+struct lock swap_lock;
+void *swap_buf;
+
+static struct partition *swap_part;     // 交换分区, 为NULL表示未启用交换
+static unsigned int slot_count;         // 交换槽总数
+static unsigned int free_slots;         // 空闲交换槽数
+static unsigned int slot_hint;          // 下次从此处开始找空闲槽, 免得每次都从头扫描
+
+/* 各交换槽的引用数, 为0表示空闲
+ * fork时换出的页不换入, 父子进程的页表项指向同一个槽, 各自换入时得到私有的副本 */
+static unsigned short *swap_map;
+
+
+/* 在分区链表中找交换分区, 找到且分区上有交换签名则启用交换 */
+void swap_init(void)
+{
+    lock_init(&swap_lock);
+    
+    struct partition *part = NULL;
+    struct list_elem *elem = partition_list.head.next;
+    while(elem != &partition_list.tail)
+    {
+        if(!strcmp((elem2entry(struct partition, partition_tag, elem))->name, SWAP_PART_NAME))
+        {
+            part = elem2entry(struct partition, partition_tag, elem);
+            break;
+        }
+        elem = elem->next;
+    }
+    if(part == NULL)
+        return;
+    
+    // 读出前两个扇区: 第一个扇区应有交换签名, 第二个扇区是文件系统的超级块所在处
+    // 带着本系统文件系统的分区即使有签名也不占用, 免得换出的页覆盖掉文件
+    swap_buf = get_kernel_pages(1);
+    if(swap_buf == NULL)
+    {
+        printk("swap: %s is unusable, swapping disabled\n", part->name);
+        return;
+    }
+    ide_read(part->my_disk, part->start_lba, swap_buf, 2);
+    if(((struct super_block *)((char *)swap_buf + SECTOR_SIZE))->magic == 0x19590318)
+    {
+        printk("swap: %s has filesystem, swapping disabled\n", part->name);
+        free_kernel_pages(swap_buf, 1);
+        swap_buf = NULL;
+        return;
+    }
+    if(memcmp(swap_buf, SWAP_SIGNATURE, strlen(SWAP_SIGNATURE)))
+    {
+        printk("swap: %s has no swap signature, swapping disabled\n", part->name);
+        free_kernel_pages(swap_buf, 1);
+        swap_buf = NULL;
+        return;
+    }
+    
+    slot_count = part->sector_count / SECTORS_PER_SLOT;
+    if(slot_count > 1)
+        swap_map = get_kernel_pages(DIV_ROUND_UP(slot_count * sizeof(unsigned short), PAGE_SIZE));
+    if(swap_map == NULL)
+    {
+        printk("swap: %s is unusable, swapping disabled\n", part->name);
+        free_kernel_pages(swap_buf, 1);
+        swap_buf = NULL;
+        slot_count = 0;
+        return;
+    }
+    
+    // 0号槽含签名所在的扇区, 永久占用
+    swap_map[0] = 1;
+    slot_hint = 1;
+    free_slots = slot_count - 1;
+    swap_part = part;
+    printk("swap: %s, %d slots\n", swap_part->name, free_slots);
+}
+
+
+/* 分区part_name是否已启用为交换分区, 文件系统不格式化也不挂载它
+ * 须在swap_init之后调用 */
+bool is_swap_partition(const char *part_name)
+{
+    return swap_part != NULL && !strcmp(part_name, swap_part->name);
+}
+
+
+/* 返回空闲交换槽数, 未启用交换时为0 */
+unsigned int swap_free_slots(void)
+{
+    return free_slots;
+}
+
+
+/* 分配一个交换槽, 成功返回槽号, 没有空闲槽返回-1 */
+signed int swap_slot_alloc(void)
+{
+    enum intr_status old_status = intr_disable();
+    if(free_slots == 0)
+    {
+        intr_set_status(old_status);
+        return -1;
+    }
+    
+    while(swap_map[slot_hint] != 0)
+        slot_hint = (slot_hint + 1) % slot_count;
+    swap_map[slot_hint] = 1;
+    free_slots--;
+    
+    signed int slot = slot_hint;
+    intr_set_status(old_status);
+    return slot;
+}
+
+
+/* fork时子进程的页表项也指向交换槽slot, 槽的引用数加1 */
+void swap_slot_dup(unsigned int slot)
+{
+    enum intr_status old_status = intr_disable();
+    ASSERT(slot < slot_count && swap_map[slot] > 0 && swap_map[slot] < 0xffff);
+    swap_map[slot]++;
+    intr_set_status(old_status);
+}
+
+
+/* 交换槽slot的引用数减1, 减到0时槽空闲 */
+void swap_slot_put(unsigned int slot)
+{
+    enum intr_status old_status = intr_disable();
+    ASSERT(slot < slot_count && swap_map[slot] > 0);
+    if(--swap_map[slot] == 0)
+        free_slots++;
+    intr_set_status(old_status);
+}
+
+
+/* 把buf中一页的内容写入交换槽slot, 调用者需持有swap_lock */
+void swap_slot_write(unsigned int slot, void *buf)
+{
+    ASSERT(slot < slot_count);
+    ide_write(swap_part->my_disk, swap_part->start_lba + slot * SECTORS_PER_SLOT, buf, SECTORS_PER_SLOT);
+}
+
+
+/* 把交换槽slot中的一页内容读入buf, 调用者需持有swap_lock */
+void swap_slot_read(unsigned int slot, void *buf)
+{
+    ASSERT(slot < slot_count);
+    ide_read(swap_part->my_disk, swap_part->start_lba + slot * SECTORS_PER_SLOT, buf, SECTORS_PER_SLOT);
+}
@@ -0,0 +1,25 @@
+#ifndef __KERNEL_SWAP_H
+#define __KERNEL_SWAP_H
+
+#include "global.h"     // bool
+#include "sync.h"       // struct lock
+
+/* 交换分区: 用户内存池耗尽时, 把不常用的用户页换出到此分区, 访问时再由缺页异常换入
+ * 分区按页划分成交换槽, 每槽8个扇区. 交换是可选的: 分区的第一个扇区须以SWAP_SIGNATURE开头,
+ * 由宿主机上的mkswap.sh写入; 没有此分区、没有签名或分区上有文件系统时不启用交换 */
+#define SWAP_PART_NAME  "sdb9"
+#define SWAP_SIGNATURE  "miniOS-SWAPSPACE"
+
+extern struct lock swap_lock;   // 换入换出互斥, 持有者独占swap_buf
+extern void *swap_buf;          // 换出时暂存页内容的缓冲区, 写盘时页框已归还
+
+void swap_init(void);
+bool is_swap_partition(const char *part_name);
+unsigned int swap_free_slots(void);
+signed int swap_slot_alloc(void);
+void swap_slot_dup(unsigned int slot);
+void swap_slot_put(unsigned int slot);
+void swap_slot_write(unsigned int slot, void *buf);
+void swap_slot_read(unsigned int slot, void *buf);
+
+#endif
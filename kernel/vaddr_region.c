@@ -0,0 +1,191 @@
+#include "vaddr_region.h"
+#include "thread.h"     // struct task_struct
+#include "process.h"    // USER_VADDR_START USER_STACK_BOTTOM
+#include "memory.h"
+#include "slab.h"
+#include "debug.h"
+
+static struct kmem_cache vaddr_region_cache;    // struct vaddr_region 对象缓存
+
+
+/* 初始化vaddr_region的对象缓存 */
+void vaddr_region_cache_init(void)
+{
+    kmem_cache_init(&vaddr_region_cache, "vaddr_region", sizeof(struct vaddr_region), NULL);
+}
+
+
+/* 新建区域[start, end), 插到链表中结点next之前, 失败返回NULL */
+static struct vaddr_region *vaddr_region_create(struct list_elem *next, unsigned int start, unsigned int end)
+{
+    struct vaddr_region *region = kmem_cache_alloc(&vaddr_region_cache);
+    if(region == NULL)
+        return NULL;
+    
+    region->start = start;
+    region->end = end;
+    list_insert_before(next, &region->region_tag);
+    return region;
+}
+
+
+/* 释放区域region */
+static void vaddr_region_destroy(struct vaddr_region *region)
+{
+    list_remove(&region->region_tag);
+    kmem_cache_free(&vaddr_region_cache, region);
+}
+
+
+/* 若区域region与其后的区域首尾相接或重叠, 则合并到region中 */
+static void vaddr_region_merge_next(struct task_struct *pthread, struct vaddr_region *region)
+{
+    while(region->region_tag.next != &pthread->vaddr_regions.tail)
+    {
+        struct vaddr_region *next = elem2entry(struct vaddr_region, region_tag, region->region_tag.next);
+        if(next->start > region->end)
+            break;
+        if(next->end > region->end)
+            region->end = next->end;
+        vaddr_region_destroy(next);
+    }
+}
+
+
+/* 在任务pthread的用户空间[USER_VADDR_START, USER_STACK_BOTTOM)中从高往低找能容纳page_count页的空洞,
+ * 取最高的空洞的顶端部分. 成功返回起始地址, 失败返回0 */
+// brk堆紧接在程序段之后往上长, mmap、共享内存和堆的arena从用户栈之下往下长, 两者在中间相遇,
+// 若从低往高分配, 第一次分配就会落在堆的结束地址处, 之后堆再也长不了
+unsigned int vaddr_region_alloc(struct task_struct *pthread, unsigned int page_count)
+{
+    unsigned int size = page_count * PAGE_SIZE, hole_start = USER_VADDR_START, found = 0;
+    ASSERT(page_count > 0);
+    
+    // 逐个检查区域之前的空洞, 后面的空洞地址更高, 能容纳时覆盖前面找到的
+    struct list_elem *elem = pthread->vaddr_regions.head.next;
+    while(hole_start < USER_STACK_BOTTOM)
+    {
+        unsigned int hole_end = USER_STACK_BOTTOM;
+        if(elem != &pthread->vaddr_regions.tail && \
+           (elem2entry(struct vaddr_region, region_tag, elem))->start < USER_STACK_BOTTOM)
+            hole_end = (elem2entry(struct vaddr_region, region_tag, elem))->start;
+        if(hole_end - hole_start >= size)
+            found = hole_end - size;
+        
+        if(hole_end == USER_STACK_BOTTOM)
+            break;
+        hole_start = (elem2entry(struct vaddr_region, region_tag, elem))->end;
+        elem = elem->next;
+    }
+    
+    if(found == 0 || !vaddr_region_reserve(pthread, found, page_count))
+        return 0;
+    return found;
+}
+
+
+/* 任务pthread中以vaddr起始的page_count页虚拟地址是否都未被占用 */
+bool vaddr_region_available(struct task_struct *pthread, unsigned int vaddr, unsigned int page_count)
+{
+    unsigned int end = vaddr + page_count * PAGE_SIZE;
+    struct list_elem *elem = pthread->vaddr_regions.head.next;
+    while(elem != &pthread->vaddr_regions.tail)
+    {
+        struct vaddr_region *region = elem2entry(struct vaddr_region, region_tag, elem);
+        if(region->start >= end)
+            break;
+        if(region->end > vaddr)
+            return false;
+        elem = elem->next;
+    }
+    return true;
+}
+
+
+/* 在任务pthread中占用以vaddr起始的page_count页虚拟地址, 不分配页框
+ * 其中已被占用的部分不受影响. 成功返回true, 内存不足返回false */
+bool vaddr_region_reserve(struct task_struct *pthread, unsigned int vaddr, unsigned int page_count)
+{
+    unsigned int end = vaddr + page_count * PAGE_SIZE;
+    ASSERT(vaddr % PAGE_SIZE == 0 && vaddr >= USER_VADDR_START && end <= 0xc0000000 && vaddr < end);
+    
+    // 找到第一个结束地址不小于vaddr的区域, 新地址段与它相接或重叠时直接扩展它
+    struct list_elem *elem = pthread->vaddr_regions.head.next;
+    struct vaddr_region *region = NULL;
+    while(elem != &pthread->vaddr_regions.tail)
+    {
+        region = elem2entry(struct vaddr_region, region_tag, elem);
+        if(region->end >= vaddr)
+            break;
+        elem = elem->next;
+    }
+    
+    if(elem == &pthread->vaddr_regions.tail || region->start > end)
+        return vaddr_region_create(elem, vaddr, end) != NULL;
+    
+    if(vaddr < region->start)
+        region->start = vaddr;
+    if(end > region->end)
+    {
+        region->end = end;
+        vaddr_region_merge_next(pthread, region);
+    }
+    return true;
+}
+
+
+/* 在任务pthread中释放以vaddr起始的page_count页虚拟地址
+ * 需要把一个区域一分为二而内存不足时, 后一半仍保持占用, 只是这段地址不能再被分配 */
+void vaddr_region_remove(struct task_struct *pthread, unsigned int vaddr, unsigned int page_count)
+{
+    unsigned int end = vaddr + page_count * PAGE_SIZE;
+    
+    struct list_elem *elem = pthread->vaddr_regions.head.next;
+    while(elem != &pthread->vaddr_regions.tail)
+    {
+        struct vaddr_region *region = elem2entry(struct vaddr_region, region_tag, elem);
+        elem = elem->next;
+        if(region->end <= vaddr)
+            continue;
+        if(region->start >= end)
+            break;
+        
+        if(region->start >= vaddr && region->end <= end)    // 整个区域都被释放
+            vaddr_region_destroy(region);
+        else if(region->start >= vaddr)     // 释放区域的前一部分
+            region->start = end;
+        else if(region->end <= end)         // 释放区域的后一部分
+            region->end = vaddr;
+        else    // 释放区域的中间部分, 后一半成为新区域
+        {
+            if(vaddr_region_create(elem, end, region->end) != NULL)
+                region->end = vaddr;
+            break;
+        }
+    }
+}
+
+
+/* fork时为子进程复制父进程的区域链表, 失败返回false */
+bool vaddr_regions_copy(struct task_struct *child_thread, struct task_struct *parent_thread)
+{
+    list_init(&child_thread->vaddr_regions);
+    
+    struct list_elem *elem = parent_thread->vaddr_regions.head.next;
+    while(elem != &parent_thread->vaddr_regions.tail)
+    {
+        struct vaddr_region *region = elem2entry(struct vaddr_region, region_tag, elem);
+        if(vaddr_region_create(&child_thread->vaddr_regions.tail, region->start, region->end) == NULL)
+            return false;
+        elem = elem->next;
+    }
+    return true;
+}
+
+
+/* 释放任务pthread的所有区域 */
+void vaddr_regions_release(struct task_struct *pthread)
+{
+    while(!list_empty(&pthread->vaddr_regions))
+        vaddr_region_destroy(elem2entry(struct vaddr_region, region_tag, pthread->vaddr_regions.head.next));
+}
@@ -0,0 +1,26 @@
+#ifndef __KERNEL_VADDR_REGION_H
+#define __KERNEL_VADDR_REGION_H
+
+#include "global.h"     // bool
+#include "list.h"
+
+struct task_struct;
+
+/* 用户进程已占用的一段虚拟地址[start, end)
+ * 进程的各区域按起始地址从低到高挂在vaddr_regions链表中, 互不重叠, 相邻的区域会合并,
+ * 因此区域数只与进程实际使用的地址段有关, 与3GB的用户空间大小无关 */
+struct vaddr_region{
+    struct list_elem region_tag;    // 用于挂到任务的vaddr_regions链表中
+    unsigned int start;             // 区域起始虚拟地址, 页对齐
+    unsigned int end;               // 区域结束虚拟地址(不含), 页对齐
+};
+
+void vaddr_region_cache_init(void);
+unsigned int vaddr_region_alloc(struct task_struct *pthread, unsigned int page_count);
+bool vaddr_region_available(struct task_struct *pthread, unsigned int vaddr, unsigned int page_count);
+bool vaddr_region_reserve(struct task_struct *pthread, unsigned int vaddr, unsigned int page_count);
+void vaddr_region_remove(struct task_struct *pthread, unsigned int vaddr, unsigned int page_count);
+bool vaddr_regions_copy(struct task_struct *child_thread, struct task_struct *parent_thread);
+void vaddr_regions_release(struct task_struct *pthread);
+
+#endif
@@ -0,0 +1,271 @@
+#include "vm_area.h"
+#include "thread.h"     // struct task_struct
+#include "memory.h"
+#include "slab.h"
+#include "file.h"       // file_read
+#include "inode.h"      // inode_close
+#include "shm.h"        // shm_attach_get shm_attach_put
+#include "image_cache.h"
+#include "debug.h"
+
+static struct kmem_cache vm_area_cache;     // struct vm_area 对象缓存
+
+
+/* 初始化vm_area的对象缓存 */
+void vm_area_cache_init(void)
+{
+    kmem_cache_init(&vm_area_cache, "vm_area", sizeof(struct vm_area), NULL);
+}
+
+
+/* 为任务pthread新建虚拟内存区域[start, end), 区域中[file_start, file_end)的内容
+ * 来自文件inode中从offset开始的部分. 区域持有inode的一次打开计数
+ * 成功返回新区域, 失败返回NULL */
+struct vm_area *vm_area_create(struct task_struct *pthread, unsigned int start, unsigned int end, \
+                               unsigned int flags, struct inode *inode, unsigned int offset, \
+                               unsigned int file_start, unsigned int file_end)
+{
+    ASSERT(start % PAGE_SIZE == 0 && end % PAGE_SIZE == 0 && start < end);
+    
+    struct vm_area *area = kmem_cache_alloc(&vm_area_cache);
+    if(area == NULL)
+        return NULL;
+    
+    area->start = start;
+    area->end = end;
+    area->flags = flags;
+    area->inode = inode;
+    area->offset = offset;
+    area->file_start = file_start;
+    area->file_end = file_end;
+    area->shm_id = -1;
+    if(inode != NULL)
+        inode->inode_open_count++;
+    
+    list_append(&pthread->vm_areas, &area->area_tag);
+    return area;
+}
+
+
+/* 在任务pthread中查找包含虚拟地址vaddr的区域, 找不到返回NULL */
+struct vm_area *vm_area_find(struct task_struct *pthread, unsigned int vaddr)
+{
+    struct list_elem *elem = pthread->vm_areas.head.next;
+    while(elem != &pthread->vm_areas.tail)
+    {
+        struct vm_area *area = elem2entry(struct vm_area, area_tag, elem);
+        if(vaddr >= area->start && vaddr < area->end)
+            return area;
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+
+/* fork时为子进程复制父进程的区域链表, 失败返回false */
+bool vm_areas_copy(struct task_struct *child_thread, struct task_struct *parent_thread)
+{
+    list_init(&child_thread->vm_areas);
+    
+    struct list_elem *elem = parent_thread->vm_areas.head.next;
+    while(elem != &parent_thread->vm_areas.tail)
+    {
+        struct vm_area *area = elem2entry(struct vm_area, area_tag, elem);
+        struct vm_area *child_area = vm_area_create(child_thread, area->start, area->end, area->flags, \
+                                                    area->inode, area->offset, area->file_start, area->file_end);
+        if(child_area == NULL)
+            return false;
+        // 子进程同样挂接着父进程的共享内存段
+        if(area->shm_id != -1)
+        {
+            child_area->shm_id = area->shm_id;
+            shm_attach_get(area->shm_id);
+        }
+        elem = elem->next;
+    }
+    return true;
+}
+
+
+/* 把区域area从所属任务的区域链表中摘下并释放, 关闭区域映射的文件 */
+// 区域中已分配的页框不在这里释放, 由调用者解除映射或随页表一起释放
+void vm_area_destroy(struct vm_area *area)
+{
+    list_remove(&area->area_tag);
+    if(area->inode != NULL)
+        inode_close(area->inode);
+    if(area->shm_id != -1)
+        shm_attach_put(area->shm_id);
+    kmem_cache_free(&vm_area_cache, area);
+}
+
+
+/* 释放任务pthread的所有区域 */
+void vm_areas_release(struct task_struct *pthread)
+{
+    while(!list_empty(&pthread->vm_areas))
+        vm_area_destroy(elem2entry(struct vm_area, area_tag, pthread->vm_areas.head.next));
+}
+
+
+/* 从任务pthread的各区域中去掉[start, end)部分, 区域因此被截成两段时新建一个区域存放后一段
+ * 成功返回true, 内存不足返回false. 区域中已分配的页框同样由调用者释放 */
+bool vm_area_remove_range(struct task_struct *pthread, unsigned int start, unsigned int end)
+{
+    struct list_elem *elem = pthread->vm_areas.head.next;
+    while(elem != &pthread->vm_areas.tail)
+    {
+        struct vm_area *area = elem2entry(struct vm_area, area_tag, elem);
+        elem = elem->next;
+        if(area->end <= start || area->start >= end)
+            continue;
+        
+        // 虚拟地址与文件偏移的对应关系由file_start和offset确定, 截短区域时不用改动
+        if(area->start >= start && area->end <= end)
+            vm_area_destroy(area);
+        else if(area->start >= start)
+            area->start = end;
+        else if(area->end <= end)
+            area->end = start;
+        else    // 从区域中间挖掉一段, 新区域挂在链表尾, 不会再被本次遍历处理
+        {
+            if(vm_area_create(pthread, end, area->end, area->flags, area->inode, \
+                              area->offset, area->file_start, area->file_end) == NULL)
+                return false;
+            area->end = start;
+        }
+    }
+    return true;
+}
+
+
+/* 区域area中落在页page内的文件内容为[*begin, *end), 页内没有文件内容则返回false */
+static bool vm_area_file_range(struct vm_area *area, unsigned int page, unsigned int *begin, unsigned int *end)
+{
+    *begin = page > area->file_start ? page : area->file_start;
+    *end = page + PAGE_SIZE < area->file_end ? page + PAGE_SIZE : area->file_end;
+    return area->inode != NULL && *begin < *end;
+}
+
+
+/* 把区域area中落在页page内的文件内容读入该页, 失败返回false */
+static bool vm_area_read_page(struct vm_area *area, unsigned int page)
+{
+    unsigned int begin, end;
+    if(!vm_area_file_range(area, page, &begin, &end))
+        return true;
+    
+    // 借一个临时的文件结构来读, 不占用文件表
+    struct file file;
+    file.fd_pos = area->offset + (begin - area->file_start);
+    file.fd_flag = O_RDONLY;
+    file.fd_inode = area->inode;
+    return file_read(&file, (void *)begin, end - begin) == (signed int)(end - begin);
+}
+
+
+/* 缺页异常时为当前进程的区域按需分配vaddr所在的页, write表示是否为写操作
+ * vaddr不在任何区域中, 或写了只读的区域, 则返回false */
+bool vm_area_fault(unsigned int vaddr, bool write)
+{
+    struct task_struct *current = running_thread();
+    unsigned int page = vaddr & 0xfffff000;
+    
+    struct vm_area *area = vm_area_find(current, page);
+    if(area == NULL || (write && !(area->flags & VM_WRITE)))
+        return false;
+    // mmap建立的区域独占所在的页, 不会与别的区域共用一页
+    bool shared = area->flags & VM_SHARED;
+    
+    // 一页可能跨两个区域, 如代码段的末尾与数据段的开头, 与此页重叠的各区域都要考虑
+    bool writable = false, file_backed = false;
+    unsigned int begin, end, overlaps = 0;
+    struct list_elem *elem = current->vm_areas.head.next;
+    while(elem != &current->vm_areas.tail)
+    {
+        struct vm_area *cur = elem2entry(struct vm_area, area_tag, elem);
+        if(page < cur->end && page + PAGE_SIZE > cur->start)
+        {
+            writable |= cur->flags & VM_WRITE;
+            file_backed |= vm_area_file_range(cur, page, &begin, &end);
+            overlaps++;
+        }
+        elem = elem->next;
+    }
+    
+    // 读一个全0的页(匿名内存或.bss)时, 只映射共享的零页, 写的时候再复制
+    // 共享映射的页要被各进程共用, 不能先映射零页, 写时再换成各自的页框
+    if(!write && !file_backed && !shared)
+        return map_zero_page(page, writable);
+    
+    // 只属于一个只读区域的文件页, 如代码段, 内容只由文件决定, 运行同一程序的进程可共用同一页框
+    bool cacheable = !writable && !shared && file_backed && overlaps == 1;
+    unsigned int pos = 0;
+    if(cacheable)
+    {
+        vm_area_file_range(area, page, &begin, &end);
+        pos = area->offset + (page - area->file_start);
+        unsigned int page_phyaddr = image_cache_get(area->inode, pos, begin - page, end - page);
+        if(page_phyaddr != 0)
+        {
+            map_shared_user_page(page, page_phyaddr, false);
+            free_a_phy_page(page_phyaddr);  // 映射后已有自己的引用, 归还查找时加的引用
+            return true;
+        }
+    }
+    
+    // 先以可写方式映射一页清0的页框, 以便读入文件内容
+    if(map_zeroed_user_page(page) == NULL)
+        return false;
+    // 读文件时会阻塞, 共享映射的页和要加入映像缓存的页要先标记好, 以免期间被当作私有页换出
+    if(shared || cacheable)
+        user_page_set_shared(page);
+    
+    elem = current->vm_areas.head.next;
+    while(elem != &current->vm_areas.tail)
+    {
+        struct vm_area *cur = elem2entry(struct vm_area, area_tag, elem);
+        if(page < cur->end && page + PAGE_SIZE > cur->start && !vm_area_read_page(cur, page))
+            return false;
+        elem = elem->next;
+    }
+    
+    if(!writable)
+        user_page_write_protect(page);
+    // 清0和读入文件时内核的写也会置上脏位, 共享映射要据脏位判断哪些页需要写回
+    if(shared)
+        user_page_clear_dirty(page);
+    if(cacheable)
+        image_cache_add(area->inode, pos, begin - page, end - page, addr_v2p(page) & 0xfffff000);
+    return true;
+}
+
+
+/* 把任务pthread的共享文件映射中落在[start, end)内且被改过的页写回文件
+ * pthread须是当前进程. 全部写回成功返回true */
+bool vm_areas_sync(struct task_struct *pthread, unsigned int start, unsigned int end)
+{
+    bool ok = true;
+    unsigned int begin, stop;
+    struct list_elem *elem = pthread->vm_areas.head.next;
+    while(elem != &pthread->vm_areas.tail)
+    {
+        struct vm_area *area = elem2entry(struct vm_area, area_tag, elem);
+        elem = elem->next;
+        if(!(area->flags & VM_SHARED) || area->inode == NULL || area->end <= start || area->start >= end)
+            continue;
+        
+        unsigned int page = area->start > start ? area->start : start;
+        unsigned int page_end = area->end < end ? area->end : end;
+        for(; page < page_end; page += PAGE_SIZE)
+        {
+            // 脏位只说明整页被写过, 写回时只写页中来自文件的那部分
+            if(!vm_area_file_range(area, page, &begin, &stop) || !user_page_clear_dirty(page))
+                continue;
+            if(file_overwrite(area->inode, area->offset + (begin - area->file_start), \
+                              (void *)begin, stop - begin) != (signed int)(stop - begin))
+                ok = false;
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,43 @@
+#ifndef __KERNEL_VM_AREA_H
+#define __KERNEL_VM_AREA_H
+
+#include "global.h"     // bool
+#include "list.h"
+
+struct task_struct;
+struct inode;
+
+#define VM_WRITE    1   // 区域可写, 否则只读
+#define VM_MMAP     2   // 区域由mmap建立, 可以用munmap解除
+#define VM_SHARED   4   // 共享映射, 页框在fork后仍由父子进程共用, 改动会写回映射的文件
+
+/* 用户进程的虚拟内存区域
+ * 区域内的页不预先分配, 首次访问引发缺页异常时才分配页框,
+ * 并从映射的文件中读入内容, 没有文件内容的部分填0 */
+struct vm_area{
+    struct list_elem area_tag;      // 用于挂到任务的vm_areas链表中
+    unsigned int start;             // 区域起始虚拟地址, 页对齐
+    unsigned int end;               // 区域结束虚拟地址(不含), 页对齐
+    unsigned int flags;             // VM_WRITE / VM_MMAP / VM_SHARED
+    
+    struct inode *inode;            // 映射的文件, 为NULL则是匿名区域
+    unsigned int offset;            // 虚拟地址file_start对应的文件偏移
+    unsigned int file_start;        // [file_start, file_end)内的内容来自文件
+    unsigned int file_end;
+    
+    signed int shm_id;              // 挂接的共享内存段, 不是共享内存段时为-1
+};
+
+void vm_area_cache_init(void);
+struct vm_area *vm_area_create(struct task_struct *pthread, unsigned int start, unsigned int end, \
+                               unsigned int flags, struct inode *inode, unsigned int offset, \
+                               unsigned int file_start, unsigned int file_end);
+struct vm_area *vm_area_find(struct task_struct *pthread, unsigned int vaddr);
+bool vm_areas_copy(struct task_struct *child_thread, struct task_struct *parent_thread);
+void vm_area_destroy(struct vm_area *area);
+void vm_areas_release(struct task_struct *pthread);
+bool vm_area_remove_range(struct task_struct *pthread, unsigned int start, unsigned int end);
+bool vm_area_fault(unsigned int vaddr, bool write);
+bool vm_areas_sync(struct task_struct *pthread, unsigned int start, unsigned int end);
+
+#endif
@@ -2,10 +2,66 @@
 #include "string.h"
 #include "debug.h"
 
+
+/* 位图所占的32位字数, 最后一个字可能不完整 */
+static unsigned int bitmap_words(struct bitmap *btmp)
+{
+    return DIV_ROUND_UP(btmp->bitmap_bytes_len, 4);
+}
+
+
+/* 读取位图的第word_index个32位字
+ * 小端序下第i位仍是第i/8字节的第i%8位, 与按字节访问一致.
+ * 位图末尾不足一个字的部分逐字节拼接, 超出位图的位视为已占用 */
+static unsigned int bitmap_word(struct bitmap *btmp, unsigned int word_index)
+{
+    unsigned int byte_index = word_index * 4;
+    if(byte_index + 4 <= btmp->bitmap_bytes_len)
+        return ((unsigned int *)btmp->bits)[word_index];
+    
+    unsigned int word = 0xffffffff, byte_odd = 0;
+    while(byte_index + byte_odd < btmp->bitmap_bytes_len)
+    {
+        word &= ~(0xff << (byte_odd * 8));
+        word |= btmp->bits[byte_index + byte_odd] << (byte_odd * 8);
+        byte_odd++;
+    }
+    return word;
+}
+
+
+/* 根据第word_index个字是否还有空闲位, 更新其摘要位 */
+static void summary_update(struct bitmap *btmp, unsigned int word_index)
+{
+    if(btmp->summary == NULL)
+        return;
+    if(bitmap_word(btmp, word_index) != 0xffffffff)
+        btmp->summary[word_index / 32] |= (1 << (word_index % 32));
+    else
+        btmp->summary[word_index / 32] &= ~(1 << (word_index % 32));
+}
+
+
 /* 位图bitmap初始化 */
 void bitmap_init(struct bitmap *btmp)
 {
     memset(btmp->bits, 0, btmp->bitmap_bytes_len);
+    bitmap_refresh(btmp);
+}
+
+
+/* 位图内容被整体改写后(如从硬盘读入或整页复制), 重建摘要位图并复位提示 */
+void bitmap_refresh(struct bitmap *btmp)
+{
+    btmp->hint = 0;
+    if(btmp->summary == NULL)
+        return;
+    
+    // 摘要位图中超出位图字数的位保持为0
+    memset(btmp->summary, 0, BITMAP_SUMMARY_BYTES(btmp->bitmap_bytes_len));
+    unsigned int word_index, word_count = bitmap_words(btmp);
+    for(word_index = 0; word_index < word_count; word_index++)
+        summary_update(btmp, word_index);
 }
 
 
@@ -18,50 +74,111 @@ bool bitmap_scan_bit(struct bitmap *btmp, unsigned int bit_index)
 }
 
 
-/* 在位图中申请连续count个位，成功则返回起始位下标，失败返回-1 */
-int bitmap_scan(struct bitmap *btmp, unsigned int count)
+/* 从bit_index位起找第一个空闲位, 找到返回其下标, 否则返回-1 */
+static int find_next_zero(struct bitmap *btmp, unsigned int bit_index)
 {
-    unsigned int byte_index = 0;    // 记录空闲位所在的字节
-    // 先逐字节比较，蛮力法
-    while((0xff == btmp->bits[byte_index]) && (byte_index < btmp->bitmap_bytes_len))
-        byte_index++;
-    
-    ASSERT(byte_index < btmp->bitmap_bytes_len);
-    if(byte_index == btmp->bitmap_bytes_len)
-        return -1;      // 若该内存池找不到可用空间
+    unsigned int word_count = bitmap_words(btmp);
+    unsigned int word_index = bit_index / 32;
+    if(word_index >= word_count)
+        return -1;
     
-    /* 若在位图数组范围内的某字节内找到了空闲位，
-     * 在该字节内逐位比对,返回空闲位的索引。*/
-    int bit_index = 0;
-    // 和btmp->bits[byte_index]这个字节逐位对比
-    while((unsigned char)(1<<bit_index) & btmp->bits[byte_index])
-        bit_index++;
+    // 起始字中低于bit_index的位视为已占用
+    unsigned int word = bitmap_word(btmp, word_index) | ((1u << (bit_index % 32)) - 1);
+    if(word != 0xffffffff)
+        return word_index * 32 + bit_scan_forward(~word);
+    word_index++;
     
-    // 空闲位在位图内的下标
-    int bit_index_begin = byte_index * 8 + bit_index;
-    if(count == 1)
-        return bit_index_begin;
+    if(btmp->summary == NULL)
+    {
+        // 没有摘要位图时逐字比较, 跳过全满的字
+        while(word_index < word_count)
+        {
+            word = bitmap_word(btmp, word_index);
+            if(word != 0xffffffff)
+                return word_index * 32 + bit_scan_forward(~word);
+            word_index++;
+        }
+        return -1;
+    }
     
-    unsigned int bit_leaving = btmp->bitmap_bytes_len * 8 - bit_index_begin;    // 记录还有多少位可以判断
-    unsigned int next_bit = bit_index_begin + 1;
-    unsigned int counting = 1;     // 用于记录找到的空闲位的个数
+    // 有摘要位图时, 一次跳过32个全满的字
+    unsigned int summary_count = DIV_ROUND_UP(word_count, 32);
+    unsigned int summary_index = word_index / 32;
+    if(summary_index >= summary_count)
+        return -1;
+    unsigned int summary = btmp->summary[summary_index] & ~((1u << (word_index % 32)) - 1);
+    while(summary == 0)
+    {
+        if(++summary_index >= summary_count)
+            return -1;
+        summary = btmp->summary[summary_index];
+    }
+    word_index = summary_index * 32 + bit_scan_forward(summary);
+    word = bitmap_word(btmp, word_index);
+    ASSERT(word != 0xffffffff);
+    return word_index * 32 + bit_scan_forward(~word);
+}
+
+
+/* 从bit_index位起找第一个已占用的位, 找到返回其下标, 否则返回位图的总位数 */
+static unsigned int find_next_one(struct bitmap *btmp, unsigned int bit_index)
+{
+    unsigned int bit_len = btmp->bitmap_bytes_len * 8;
+    unsigned int word_count = bitmap_words(btmp);
+    unsigned int word_index = bit_index / 32;
+    if(word_index >= word_count)
+        return bit_len;
     
-    bit_index_begin = -1;   // 先将其置为-1，若找不到连续的位就直接返回
-    while(bit_leaving-- > 0)
+    unsigned int word = bitmap_word(btmp, word_index) & ~((1u << (bit_index % 32)) - 1);
+    while(word == 0)
+    {
+        if(++word_index >= word_count)
+            return bit_len;
+        word = bitmap_word(btmp, word_index);
+    }
+    bit_index = word_index * 32 + bit_scan_forward(word);
+    return bit_index < bit_len ? bit_index : bit_len;
+}
+
+
+/* 从bit_begin位起在位图中找连续count个空闲位, 成功则返回起始位下标，失败返回-1 */
+static int scan_from(struct bitmap *btmp, unsigned int bit_begin, unsigned int count)
+{
+    while(1)
     {
-        if(!(bitmap_scan_bit(btmp, next_bit)))
-            counting++;
-        else
-            counting = 0;
+        int free_begin = find_next_zero(btmp, bit_begin);
+        if(free_begin == -1 || count == 1)
+            return free_begin;
         
-        if(counting == count)   // 若找到连续的count个空位
-        {
-            bit_index_begin = next_bit - count + 1;
-            break;
-        }
-        next_bit++;
-    }        
-    return bit_index_begin;
+        // 空闲段的长度 = 下一个已占用位的下标 - 空闲段起始下标
+        unsigned int used_begin = find_next_one(btmp, free_begin + 1);
+        if(used_begin - free_begin >= count)
+            return free_begin;
+        
+        // 这段空闲位不够长, 从下一个已占用位之后继续找
+        if(used_begin >= btmp->bitmap_bytes_len * 8)
+            return -1;
+        bit_begin = used_begin;
+    }
+}
+
+
+/* 在位图中申请连续count个位，成功则返回起始位下标，失败返回-1
+ * 采用next-fit, 从上次分配结束处开始找, 找不到再从头找一遍 */
+int bitmap_scan(struct bitmap *btmp, unsigned int count)
+{
+    unsigned int bit_len = btmp->bitmap_bytes_len * 8;
+    if(count == 0 || count > bit_len)
+        return -1;
+    
+    unsigned int bit_begin = btmp->hint < bit_len ? btmp->hint : 0;
+    int bit_index = scan_from(btmp, bit_begin, count);
+    if(bit_index == -1 && bit_begin != 0)
+        bit_index = scan_from(btmp, 0, count);
+    
+    if(bit_index != -1)
+        btmp->hint = bit_index + count;
+    return bit_index;
 }
 
 
@@ -76,5 +193,6 @@ void bitmap_set(struct bitmap *btmp, unsigned int bit_index, signed char value)
         btmp->bits[byte_index] |= (1<<bit_odd);
     else
         btmp->bits[byte_index] &= ~(1<<bit_odd);
+    
+    summary_update(btmp, bit_index / 32);
 }
-
@@ -3,15 +3,31 @@
 
 #include "global.h"
 
+/* 位图以32位字为单位扫描, 并附带一层摘要位图:
+ * 摘要中的第i位为1, 表示位图的第i个32位字中还有空闲位(值为0的位) */
 struct bitmap{
-    // 遍历位图时整体上以字节为单位，细节上以位为单位
+    // 遍历位图时整体上以32位字为单位，细节上以位为单位
     unsigned int bitmap_bytes_len;
     unsigned char *bits;    // 位图所在内存的起始地址
+    unsigned int *summary;  // 摘要位图的起始地址, 由使用者按BITMAP_SUMMARY_BYTES分配, 为NULL时不使用摘要
+    unsigned int hint;      // next-fit提示, 下次从该位开始扫描
 };
 
+/* 长度为bytes_len字节的位图, 其摘要位图所需的字节数 */
+#define BITMAP_SUMMARY_BYTES(bytes_len) (DIV_ROUND_UP(DIV_ROUND_UP(bytes_len, 4), 32) * 4)
+
+/* 返回32位字word中最低的1所在的位下标, word不能为0 */
+static inline unsigned int bit_scan_forward(unsigned int word)
+{
+    unsigned int bit_index;
+    asm ("bsfl %1, %0" : "=r" (bit_index) : "rm" (word));
+    return bit_index;
+}
+
 void bitmap_init(struct bitmap *btmp);
+void bitmap_refresh(struct bitmap *btmp);
 bool bitmap_scan_bit(struct bitmap *btmp, unsigned int bit_index);
 int bitmap_scan(struct bitmap *btmp, unsigned int count);
 void bitmap_set(struct bitmap *btmp, unsigned int index, signed char value);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,257 @@
+#include "malloc.h"
+#include "syscall.h"    // sbrk
+#include "global.h"     // NULL PAGE_SIZE DIV_ROUND_UP
+#include "string.h"     // memcpy
+
+#define BLOCK_CLASSES       7       // 内存块规格数, 16 32 64 128 256 512 1024字节
+#define BLOCK_MIN_SIZE      16
+#define BLOCK_MAX_SIZE      1024
+
+#define HEAP_PAGE_HEADER    16      // 页头占用的字节数, 页头之后的内存块按16字节对齐
+#define HEAP_TRIM_PAGES     16      // 堆顶的空闲大块达到此页数时才还给内核, 免得反复申请释放时频繁陷入内核
+
+/* 堆页头, 位于每个小内存块页或大块的起始处, free时由地址所在的页找到它
+ * 大块返回给用户的地址紧跟在页头之后, 因此同样按页对齐取整即可找到页头 */
+struct heap_page{
+    unsigned int block_class;   // 页中内存块的规格下标, 为BLOCK_CLASSES表示大块
+    unsigned int page_count;    // 大块占用的页数
+    struct heap_page *next;     // 空闲大块按地址从低到高链接
+};
+
+/* 空闲内存块, 链表指针借用内存块自身的空间 */
+struct free_block{
+    struct free_block *next;
+};
+
+static struct free_block *free_blocks[BLOCK_CLASSES];   // 各规格的空闲内存块链表
+static struct heap_page *free_chunks;   // 空闲大块链表, 相邻的空闲大块会合并
+
+
+/* 取page_count页的堆内存, 优先从空闲大块中切, 不够再用sbrk扩展堆. 失败返回NULL */
+static struct heap_page *heap_pages_get(unsigned int page_count)
+{
+    struct heap_page **link = &free_chunks;
+    while(*link != NULL)
+    {
+        struct heap_page *chunk = *link;
+        if(chunk->page_count == page_count)
+        {
+            *link = chunk->next;
+            return chunk;
+        }
+        if(chunk->page_count > page_count)  // 从尾部切下所需的页, 其余的仍留在链表中
+        {
+            chunk->page_count -= page_count;
+            chunk = (struct heap_page *)((unsigned int)chunk + chunk->page_count * PAGE_SIZE);
+            chunk->page_count = page_count;
+            return chunk;
+        }
+        link = &chunk->next;
+    }
+    
+    // 程序可能自己用sbrk把堆的结束地址改得不按页对齐, 先补齐到页边界
+    unsigned int heap_end = (unsigned int)sbrk(0);
+    unsigned int pad = (PAGE_SIZE - heap_end % PAGE_SIZE) % PAGE_SIZE;
+    if(sbrk(pad + page_count * PAGE_SIZE) == (void *)-1)
+        return NULL;
+    
+    struct heap_page *chunk = (struct heap_page *)(heap_end + pad);
+    chunk->page_count = page_count;
+    return chunk;
+}
+
+
+/* 归还大块chunk, 按地址插入空闲大块链表并与前后相接的空闲大块合并 */
+static void heap_pages_put(struct heap_page *chunk)
+{
+    struct heap_page *prev = NULL, *next = free_chunks;
+    while(next != NULL && next < chunk)
+    {
+        prev = next;
+        next = next->next;
+    }
+    
+    if(next != NULL && (unsigned int)chunk + chunk->page_count * PAGE_SIZE == (unsigned int)next)
+    {
+        chunk->page_count += next->page_count;
+        next = next->next;
+    }
+    chunk->next = next;
+    
+    if(prev != NULL && (unsigned int)prev + prev->page_count * PAGE_SIZE == (unsigned int)chunk)
+    {
+        prev->page_count += chunk->page_count;
+        prev->next = chunk->next;
+    }
+    else if(prev != NULL)
+        prev->next = chunk;
+    else
+        free_chunks = chunk;
+}
+
+
+/* 空闲大块链表中的最后一块位于堆顶且够大时, 缩小堆把它还给内核 */
+static void heap_trim(void)
+{
+    if(free_chunks == NULL)
+        return;
+    
+    struct heap_page **link = &free_chunks;
+    while((*link)->next != NULL)
+        link = &(*link)->next;
+    
+    struct heap_page *chunk = *link;
+    unsigned int bytes = chunk->page_count * PAGE_SIZE;
+    if(chunk->page_count >= HEAP_TRIM_PAGES && (unsigned int)chunk + bytes == (unsigned int)sbrk(0) && \
+       sbrk(-(signed int)bytes) != (void *)-1)
+        *link = NULL;
+}
+
+
+/* 申请size字节的内存, 成功返回其地址, 失败返回NULL */
+void *malloc(unsigned int size)
+{
+    // 大块的页数要放得进sbrk的参数
+    if(size == 0 || size > 0x40000000)
+        return NULL;
+    
+    if(size > BLOCK_MAX_SIZE)
+    {
+        struct heap_page *chunk = heap_pages_get(DIV_ROUND_UP(size + HEAP_PAGE_HEADER, PAGE_SIZE));
+        if(chunk == NULL)
+            return NULL;
+        chunk->block_class = BLOCK_CLASSES;
+        return (void *)((unsigned int)chunk + HEAP_PAGE_HEADER);
+    }
+    
+    // 找到能容纳size的最小规格
+    unsigned int class_index = 0, block_size = BLOCK_MIN_SIZE;
+    while(block_size < size)
+    {
+        block_size *= 2;
+        class_index++;
+    }
+    
+    // 该规格没有空闲内存块了, 取一页切成该规格的内存块
+    if(free_blocks[class_index] == NULL)
+    {
+        struct heap_page *page = heap_pages_get(1);
+        if(page == NULL)
+            return NULL;
+        page->block_class = class_index;
+        
+        unsigned int block = (unsigned int)page + HEAP_PAGE_HEADER;
+        while(block + block_size <= (unsigned int)page + PAGE_SIZE)
+        {
+            ((struct free_block *)block)->next = free_blocks[class_index];
+            free_blocks[class_index] = (struct free_block *)block;
+            block += block_size;
+        }
+    }
+    
+    struct free_block *block = free_blocks[class_index];
+    free_blocks[class_index] = block->next;
+    return block;
+}
+
+
+/* 释放malloc得到的内存ptr
+ * 小内存块放回所属规格的空闲链表, 其所在的页留在堆中不归还; 大块按页归还 */
+void free(void *ptr)
+{
+    if(ptr == NULL)
+        return;
+    
+    struct heap_page *page = (struct heap_page *)((unsigned int)ptr & 0xfffff000);
+    if(page->block_class == BLOCK_CLASSES)
+    {
+        heap_pages_put(page);
+        heap_trim();
+        return;
+    }
+    
+    struct free_block *block = ptr;
+    block->next = free_blocks[page->block_class];
+    free_blocks[page->block_class] = block;
+}
+
+
+/* 把紧接在大块chunk之后的extra页并入chunk, 成功返回true
+ * 其后是空闲大块时从它的开头切下所需的页, chunk位于堆顶时直接用sbrk扩展堆 */
+static bool heap_pages_extend(struct heap_page *chunk, unsigned int extra)
+{
+    unsigned int end = (unsigned int)chunk + chunk->page_count * PAGE_SIZE;
+    
+    struct heap_page **link = &free_chunks;
+    while(*link != NULL && (unsigned int)*link < end)
+        link = &(*link)->next;
+    
+    struct heap_page *next = *link;
+    if(next != NULL && (unsigned int)next == end && next->page_count >= extra)
+    {
+        if(next->page_count == extra)
+            *link = next->next;
+        else    // 剩下的页在原位置之后另起页头, 替换链表中原来的结点
+        {
+            struct heap_page *rest = (struct heap_page *)(end + extra * PAGE_SIZE);
+            rest->page_count = next->page_count - extra;
+            rest->next = next->next;
+            *link = rest;
+        }
+    }
+    else if(end != (unsigned int)sbrk(0) || sbrk(extra * PAGE_SIZE) == (void *)-1)
+        return false;
+    
+    chunk->page_count += extra;
+    return true;
+}
+
+
+/* 把ptr处的内存调整为size字节, 返回调整后的地址, 原有内容保持不变
+ * ptr为NULL时等同于malloc, size为0时等同于free并返回NULL
+ * 小内存块的规格容得下size、大块之后的页空闲或大块位于堆顶时就地调整, 否则申请新内存并复制
+ * 失败返回NULL, 原内存不受影响 */
+void *realloc(void *ptr, unsigned int size)
+{
+    if(ptr == NULL)
+        return malloc(size);
+    if(size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+    if(size > 0x40000000)
+        return NULL;
+    
+    struct heap_page *page = (struct heap_page *)((unsigned int)ptr & 0xfffff000);
+    unsigned int capacity;
+    if(page->block_class < BLOCK_CLASSES)
+    {
+        capacity = BLOCK_MIN_SIZE << page->block_class;
+        if(size <= capacity)
+            return ptr;
+    }
+    else
+    {
+        capacity = page->page_count * PAGE_SIZE - HEAP_PAGE_HEADER;
+        unsigned int page_count = DIV_ROUND_UP(size + HEAP_PAGE_HEADER, PAGE_SIZE);
+        if(page_count < page->page_count)     // 缩小时把尾部的页作为空闲大块归还
+        {
+            struct heap_page *tail = (struct heap_page *)((unsigned int)page + page_count * PAGE_SIZE);
+            tail->page_count = page->page_count - page_count;
+            page->page_count = page_count;
+            heap_pages_put(tail);
+            heap_trim();
+            return ptr;
+        }
+        if(page_count == page->page_count || heap_pages_extend(page, page_count - page->page_count))
+            return ptr;
+    }
+    
+    void *new_ptr = malloc(size);
+    if(new_ptr == NULL)
+        return NULL;
+    memcpy(new_ptr, ptr, capacity < size ? capacity : size);
+    free(ptr);
+    return new_ptr;
+}
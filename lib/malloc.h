@@ -0,0 +1,12 @@
+#ifndef __LIB_MALLOC_H
+#define __LIB_MALLOC_H
+
+/* 用户态的堆分配器
+ * 不超过1024字节的申请按16~1024字节的7种规格, 从各自的空闲链表中分配, 不必陷入内核;
+ * 链表空了才通过sbrk扩展堆, 一次取一页切成同规格的内存块. 更大的申请直接按页分配
+ * realloc能就地调整时不移动内存, 免得每次扩大缓冲区都要复制 */
+void *malloc(unsigned int size);
+void free(void *ptr);
+void *realloc(void *ptr, unsigned int size);
+
+#endif
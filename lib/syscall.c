@@ -105,19 +105,6 @@ unsigned int write(signed int fd, const void *buf, unsigned int count)
 }
 
 
-/* 申请size字节大小的内存, 并返回内存首地址 */
-void *malloc(unsigned int size)
-{
-    return (void *)_syscall1(SYS_MALLOC, size);
-}
-
-/* 释放vaddr指向的内存 */
-void free(void *vaddr)
-{
-    _syscall1(SYS_FREE, vaddr);
-}
-
-
 /* 派生子进程, 返回子进程pid */
 signed short int fork()
 {
@@ -266,3 +253,79 @@ void help(void)
 {
     _syscall0(SYS_HELP);
 }
+
+
+/* 在进程地址空间中映射length字节, 失败返回MAP_FAILED */
+void *mmap(void *addr, unsigned int length, signed int prot, signed int flags, signed int fd, unsigned int offset)
+{
+    struct mmap_args args = {addr, length, prot, flags, fd, offset};
+    return (void *)_syscall1(SYS_MMAP, &args);
+}
+
+/* 解除以addr起始的length字节的映射 */
+signed int munmap(void *addr, unsigned int length)
+{
+    return _syscall2(SYS_MUNMAP, addr, length);
+}
+
+/* 把共享文件映射中改过的页写回文件 */
+signed int msync(void *addr, unsigned int length, signed int flags)
+{
+    return _syscall3(SYS_MSYNC, addr, length, flags);
+}
+
+/* 取得键key对应的共享内存段, 返回段标识 */
+signed int shmget(signed int key, unsigned int size, signed int flag)
+{
+    return _syscall3(SYS_SHMGET, key, size, flag);
+}
+
+/* 把共享内存段挂接到进程的地址空间, 返回挂接的地址, 失败返回(void *)-1 */
+void *shmat(signed int shm_id, const void *addr, signed int flag)
+{
+    return (void *)_syscall3(SYS_SHMAT, shm_id, addr, flag);
+}
+
+/* 脱离挂接在addr处的共享内存段 */
+signed int shmdt(const void *addr)
+{
+    return _syscall1(SYS_SHMDT, addr);
+}
+
+/* 控制共享内存段, 目前只支持IPC_RMID */
+signed int shmctl(signed int shm_id, signed int cmd, void *buf)
+{
+    return _syscall3(SYS_SHMCTL, shm_id, cmd, buf);
+}
+
+/* 把堆的结束地址设为addr, 成功返回0, 失败返回-1 */
+signed int brk(void *addr)
+{
+    return _syscall1(SYS_BRK, addr) == (signed int)addr ? 0 : -1;
+}
+
+/* 把堆扩大increment字节, 为负则缩小, 成功返回原来的堆结束地址, 失败返回(void *)-1 */
+void *sbrk(signed int increment)
+{
+    unsigned int old_brk = _syscall1(SYS_BRK, 0);
+    if(increment == 0)
+        return (void *)old_brk;
+    
+    // 越过地址空间两端的调整直接失败
+    unsigned int new_brk = old_brk + increment;
+    if((increment > 0 && new_brk < old_brk) || (increment < 0 && new_brk > old_brk))
+        return (void *)-1;
+    return (unsigned int)_syscall1(SYS_BRK, new_brk) == new_brk ? (void *)old_brk : (void *)-1;
+}
+
+/* 取内存池、内核堆及当前进程堆的使用情况 */
+signed int meminfo(struct mem_info *info)
+{
+    return _syscall1(SYS_MEMINFO, info);
+}
+
+/* 取堆分配剖析中申请次数最多的前count个调用点 */
+signed int heapprof(struct heap_site_info *sites, unsigned int count)
+{
+    return _syscall2(SYS_HEAPPROF, sites, count);
+}
@@ -2,6 +2,11 @@
 #define __LIB_SYSCALL_H
 
 #include "fs.h"     // struct stat
+#include "mmap.h"   // PROT_* MAP_*
+#include "shm.h"    // IPC_* SHM_*
+#include "malloc.h" // malloc free, 用户态的堆分配器, 由brk扩展堆
+#include "memory.h" // struct mem_info
+#include "heap_profile.h"   // struct heap_site_info
 
 enum SYSCALL_NR{
     SYS_GETPID,
@@ -36,7 +41,20 @@ enum SYSCALL_NR{
     SYS_FD_REDIRECT,
     SYS_PIPE,
     
-    SYS_HELP
+    SYS_HELP,
+    
+    SYS_MMAP,
+    SYS_MUNMAP,
+    SYS_MSYNC,
+    
+    SYS_SHMGET,
+    SYS_SHMAT,
+    SYS_SHMDT,
+    SYS_SHMCTL,
+    
+    SYS_BRK,
+    SYS_MEMINFO,
+    SYS_HEAPPROF
 };
 
 unsigned int getpid(void);
@@ -45,9 +63,6 @@ unsigned int getpid(void);
 /* 把buf中count个字符写入文件描述符fd */
 unsigned int write(signed int fd, const void *buf, unsigned int count);
 
-void *malloc(unsigned int size);
-void free(void *vaddr);
-
 signed short int fork(void);
 
 
@@ -95,4 +110,30 @@ signed int pipe(signed int pipefd[2]);
 /* 显示系统支持的命令 */
 void help(void);
 
+/* 在进程地址空间中映射length字节或文件fd中从offset起的内容, 用法同POSIX, 不支持MAP_FIXED */
+void *mmap(void *addr, unsigned int length, signed int prot, signed int flags, signed int fd, unsigned int offset);
+/* 解除以addr起始的length字节的映射 */
+signed int munmap(void *addr, unsigned int length);
+/* 把共享文件映射中改过的页写回文件 */
+signed int msync(void *addr, unsigned int length, signed int flags);
+
+/* 取得键key对应的共享内存段, 返回段标识 */
+signed int shmget(signed int key, unsigned int size, signed int flag);
+/* 把共享内存段挂接到进程的地址空间, 返回挂接的地址, 失败返回(void *)-1 */
+void *shmat(signed int shm_id, const void *addr, signed int flag);
+/* 脱离挂接在addr处的共享内存段 */
+signed int shmdt(const void *addr);
+/* 控制共享内存段, 目前只支持IPC_RMID */
+signed int shmctl(signed int shm_id, signed int cmd, void *buf);
+
+/* 把堆的结束地址设为addr, 成功返回0, 失败返回-1 */
+signed int brk(void *addr);
+/* 把堆扩大increment字节, 为负则缩小, 成功返回原来的堆结束地址, 失败返回(void *)-1 */
+void *sbrk(signed int increment);
+
+/* 取内存池、内核堆及当前进程堆的使用情况 */
+signed int meminfo(struct mem_info *info);
+/* 取堆分配剖析中申请次数最多的前count个调用点, 返回取到的个数, 内核未编入剖析时返回-1 */
+signed int heapprof(struct heap_site_info *sites, unsigned int count);
+
 #endif
\ No newline at end of file
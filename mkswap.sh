@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# 把硬盘映像中的一个分区标记为交换分区: 在分区的第一个扇区开头写入交换签名
+# 内核只在名为sdb9(见kernel/swap.h中的SWAP_PART_NAME)且带签名的分区上启用交换, 默认不启用
+# 用法: ./mkswap.sh 硬盘映像 分区起始扇区号
+#       如 ./mkswap.sh hd80M.img 121023, 起始扇区号可用 fdisk -l hd80M.img 查看
+# 分区上已有本系统的文件系统时拒绝写入, 换出的页会覆盖掉其中的文件
+
+SIGNATURE="miniOS-SWAPSPACE"    # 与kernel/swap.h中的SWAP_SIGNATURE一致
+FS_MAGIC="18035919"             # 超级块开头的魔数0x19590318, 按小端序存放
+
+if [ $# -ne 2 ]
+then
+    echo "usage: $0 disk_image start_lba"
+    exit 1
+fi
+
+IMAGE=$1
+LBA=$2
+
+if [ ! -f $IMAGE ]
+then
+    echo "## ERROR: $IMAGE not found !!! ##"
+    exit 1
+fi
+
+# 超级块在分区的第二个扇区
+MAGIC=$(dd if=$IMAGE bs=512 skip=$((LBA + 1)) count=1 2>/dev/null | od -An -tx1 -N4 | tr -d ' \n')
+if [ "$MAGIC" = "$FS_MAGIC" ]
+then
+    echo "## ERROR: partition at LBA $LBA has filesystem, refuse to overwrite !!! ##"
+    exit 1
+fi
+
+printf "%s" $SIGNATURE | dd of=$IMAGE bs=512 seek=$LBA conv=notrunc 2>/dev/null
+echo "swap signature written to $IMAGE at LBA $LBA"
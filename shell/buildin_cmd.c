@@ -275,6 +275,80 @@ void buildin_ps(unsigned int argc, char **argv __attribute__((unused)))
 }
 
 
+/* 打印一个内存池的使用情况 */
+static void pool_info_print(const char *name, const struct pool_info *info)
+{
+    printf("%s pool: %d pages, used %d, free %d (zeroed %d), largest free block %d pages\n", name, \
+           info->total_pages, info->total_pages - info->free_pages, info->free_pages, \
+           info->zero_pages, info->largest_free_pages);
+}
+
+
+/* 打印一个堆中各规格内存块及大块内存的使用情况 */
+static void heap_info_print(const char *name, const struct block_class_info *blocks, \
+                            const struct mem_large_stat *large)
+{
+    printf("%s heap:\n", name);
+    unsigned int desc_index;
+    for(desc_index = 0; desc_index < MEM_DESC_COUNT; desc_index++)
+    {
+        printf("    %d bytes: %d arenas, %d free blocks, %d cached\n", blocks[desc_index].block_size, \
+               blocks[desc_index].arenas, blocks[desc_index].free_blocks, blocks[desc_index].cached_blocks);
+    }
+    printf("    large: %d allocations, %d pages\n", large->count, large->pages);
+}
+
+
+/* meminfo命令内建函数, 显示各内存池、内核堆及shell进程自己的堆的使用情况 */
+void buildin_meminfo(unsigned int argc, char **argv __attribute__((unused)))
+{
+    if(argc != 1)
+    {
+        printf("meminfo: no argument support!\n");
+        return;
+    }
+    
+    struct mem_info info;
+    if(meminfo(&info) == -1)
+    {
+        printf("meminfo: get memory information failed\n");
+        return;
+    }
+    pool_info_print("kernel", &info.kernel);
+    pool_info_print("user", &info.user);
+    heap_info_print("kernel", info.kernel_blocks, &info.kernel_large);
+    heap_info_print("process", info.user_blocks, &info.user_large);
+}
+
+
+/* heapprof命令内建函数, 显示申请堆内存最频繁的调用点
+ * 调用点是sys_malloc的返回地址, 用heap_symbolize.sh对照build/kernel.map换成函数名 */
+void buildin_heapprof(unsigned int argc, char **argv __attribute__((unused)))
+{
+    if(argc != 1)
+    {
+        printf("heapprof: no argument support!\n");
+        return;
+    }
+    
+    struct heap_site_info sites[HEAP_PROFILE_TOP];
+    signed int count = heapprof(sites, HEAP_PROFILE_TOP);
+    if(count == -1)
+    {
+        printf("heapprof: kernel is built without HEAP_PROFILE\n");
+        return;
+    }
+    printf("caller  allocs  frees  total  live  peak  allocs/s  avg_life(ms)  oldest(ms)\n");
+    signed int idx;
+    for(idx = 0; idx < count; idx++)
+    {
+        printf("0x%x  %d  %d  %d  %d  %d  %d  %d  %d\n", (unsigned int)sites[idx].caller, sites[idx].allocs, \
+               sites[idx].frees, sites[idx].total_bytes, sites[idx].live_bytes, sites[idx].peak_bytes, \
+               sites[idx].allocs_per_sec, sites[idx].avg_lifetime_ms, sites[idx].oldest_live_ms);
+    }
+}
+
+
 /* clear命令内建函数 */
 void buildin_clear(unsigned int argc, char **argv __attribute__((unused)))
 {
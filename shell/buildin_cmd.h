@@ -13,6 +13,8 @@ signed int buildin_rm(unsigned int argc, char** argv);
 void buildin_pwd(unsigned int argc, char** argv);
 void buildin_ps(unsigned int argc, char** argv);
 void buildin_clear(unsigned int argc, char** argv);
+void buildin_meminfo(unsigned int argc, char** argv);
+void buildin_heapprof(unsigned int argc, char** argv);
 
 
 /* 显示内建命令列表 */
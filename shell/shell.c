@@ -162,6 +162,14 @@ static void cmd_execute(unsigned int argc, char **argv)
     {
         buildin_ps(argc, argv);
     }
+    else if (!strcmp("meminfo", argv[0]))
+    {
+        buildin_meminfo(argc, argv);
+    }
+    else if (!strcmp("heapprof", argv[0]))
+    {
+        buildin_heapprof(argc, argv);
+    }
     else if (!strcmp("clear", argv[0]))
     {
         buildin_clear(argc, argv);
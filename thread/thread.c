@@ -24,7 +24,9 @@ extern void init(void);
 struct task_struct *main_thread;    // 主线程PCB
 struct task_struct *idle_thread;    // idle线程, 系统空闲时运行的线程
 
-struct list thread_ready_list;      // 就绪队列
+// 就绪队列, 每个调度级别一个, 同级别内先进先出
+static struct list thread_ready_lists[MLFQ_LEVELS];
+static unsigned int ready_levels;   // 第i位为1表示级别i的就绪队列非空, 挑选下个任务时直接找最低的1
 
 // 当线程因为某些原因阻塞了，不能放在就绪队列中
 struct list thread_all_list;        // 所有任务队列
@@ -35,6 +37,7 @@ static struct list_elem *thread_tag;    // 用于保存队列中的线程结点
 
 /* pid 的位图, 最大支持1024个pid */
 unsigned char pid_bitmap_bits[128] = {0};   // 128 * 8 = 1024
+unsigned int pid_bitmap_summary[BITMAP_SUMMARY_BYTES(128) / 4];  // pid位图的摘要
 
 // pid 池
 struct pid_pool{
@@ -56,6 +59,7 @@ static void pid_pool_init(void)
     
     pid_pool.pid_bitmap.bits = pid_bitmap_bits;
     pid_pool.pid_bitmap.bitmap_bytes_len = 128;
+    pid_pool.pid_bitmap.summary = pid_bitmap_summary;
     bitmap_init(&pid_pool.pid_bitmap);
     lock_init(&pid_pool.pid_lock);
 }
@@ -160,9 +164,13 @@ void init_thread(struct task_struct *pthread, char *name, int priority)
     // self_kstack是线程自己在内核态下使用的栈顶地址
     pthread->self_kstack = (unsigned int *)((unsigned int)pthread + PAGE_SIZE); // 参数phtread为最低地址
     pthread->priority = priority;
-    pthread->ticks = priority;
+    pthread->mlfq_level = 0;    // 新任务从最高级别开始, 用完时间片再逐级下降
+    pthread->ticks = thread_time_slice(pthread);
     pthread->elapsed_ticks = 0;
     pthread->pgdir = NULL;
+    list_init(&pthread->vaddr_regions);
+    list_init(&pthread->vm_areas);
+    pthread->start_brk = pthread->brk = 0;
     
     /* 初始化文件描述符数组 */
     pthread->fd_table[0] = 0;   // 预留标准输入0 标注输出1 标准错误2
@@ -196,10 +204,8 @@ struct task_struct *thread_start(char *name, int priority, thread_func function,
     thread_create(thread, function, func_arg);  // 初始化线程栈
     
     
-    // 确保之前不在队列中
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
     // 加入就绪线程队列
-    list_append(&thread_ready_list, &thread->general_tag);
+    thread_ready_append(thread);
     
     // 确保之前不在队列中
     ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
@@ -240,7 +246,7 @@ static void make_main_thread(void)
     main_thread = running_thread();
     init_thread(main_thread, "main", 31);
     
-    // main函数是当前线程，当前线程不在thread_ready_list中，所以只加在thread_all_list中
+    // main函数是当前线程，当前线程不在就绪队列中，所以只加在thread_all_list中
     ASSERT(!elem_find(&thread_all_list, &main_thread->all_list_tag));
     list_append(&thread_all_list, &main_thread->all_list_tag);
 }
@@ -248,6 +254,77 @@ static void make_main_thread(void)
 
 
 
+/* 线程在其所在级别上的时间片 */
+unsigned char thread_time_slice(struct task_struct *pthread)
+{
+    unsigned char slice = pthread->priority >> (MLFQ_LEVELS - 1 - pthread->mlfq_level);
+    return slice == 0 ? 1 : slice;
+}
+
+
+/* 把线程pthread加入其所在级别的就绪队列尾, 调用者需关中断 */
+void thread_ready_append(struct task_struct *pthread)
+{
+    ASSERT(pthread->mlfq_level < MLFQ_LEVELS);
+    struct list *ready_list = &thread_ready_lists[pthread->mlfq_level];
+    ASSERT(!elem_find(ready_list, &pthread->general_tag));
+    list_append(ready_list, &pthread->general_tag);
+    ready_levels |= 1 << pthread->mlfq_level;
+}
+
+
+/* 把就绪的线程pthread从就绪队列中摘下, 调用者需关中断 */
+static void ready_list_remove(struct task_struct *pthread)
+{
+    list_remove(&pthread->general_tag);
+    if(list_empty(&thread_ready_lists[pthread->mlfq_level]))
+        ready_levels &= ~(1 << pthread->mlfq_level);
+}
+
+
+/* 是否没有就绪的任务 */
+bool thread_ready_empty(void)
+{
+    return ready_levels == 0;
+}
+
+
+/* 是否有比当前任务级别更高的任务就绪, 由时钟中断调用, 有则不等时间片用完就切换
+ * 这样批处理程序在运行时, 被唤醒的交互式任务最多等一个时钟嘀嗒就能上CPU */
+bool thread_need_preempt(struct task_struct *current)
+{
+    if(current == idle_thread)
+        return ready_levels != 0;
+    return (ready_levels & ((1 << current->mlfq_level) - 1)) != 0;
+}
+
+
+/* 老化: 所有任务各升一级, 由时钟中断每隔MLFQ_AGING_TICKS调用一次
+ * 免得一直有高级别任务就绪时, 低级别的任务饿死 */
+void thread_aging(void)
+{
+    ASSERT(intr_get_status() == INTR_OFF);
+    
+    struct list_elem *elem = thread_all_list.head.next;
+    while(elem != &thread_all_list.tail)
+    {
+        struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, elem);
+        elem = elem->next;
+        if(pthread->mlfq_level == 0)
+            continue;
+        
+        if(pthread->status == TASK_READY)
+        {
+            ready_list_remove(pthread);
+            pthread->mlfq_level--;
+            thread_ready_append(pthread);
+        }
+        else
+            pthread->mlfq_level--;
+    }
+}
+
+
 /* 实现任务调度
  * 将当前线程换下处理器，并在就绪队列中找出下个可运行的程序，将其换上处理器 */
 // 由device/timer.c中的时钟中断处理函数调用
@@ -260,12 +337,23 @@ void schedule()
     struct task_struct *current_thread = running_thread();
     if(current_thread->status == TASK_RUNNING)
     {
-        // 若此线程只是cpu时间片到了，将其加入到就绪队列尾
-        ASSERT(!elem_find(&thread_ready_list, &current_thread->general_tag));
-        list_append(&thread_ready_list, &current_thread->general_tag);
+        // 若此线程用完了整个时间片, 说明它是计算密集的, 降一级并重新充满时间片
+        // 若只是被更高级别的就绪任务抢占, 保持级别和剩余的时间片
+        if(current_thread->ticks == 0)
+        {
+            if(current_thread->mlfq_level < MLFQ_LEVELS - 1)
+                current_thread->mlfq_level++;
+            current_thread->ticks = thread_time_slice(current_thread);
+        }
         
-        current_thread->ticks = current_thread->priority; // 将此线程的ticks重置为其priority
-        current_thread->status = TASK_READY;
+        // idle只在没有别的任务可运行时才上CPU, 不进就绪队列
+        if(current_thread == idle_thread)
+            current_thread->status = TASK_BLOCKED;
+        else
+        {
+            thread_ready_append(current_thread);    // 加入其所在级别的就绪队列尾
+            current_thread->status = TASK_READY;
+        }
     }
     else
     {
@@ -273,17 +361,17 @@ void schedule()
         // 因为当前线程不在就绪队列中
     }
     
-    // 如果就绪队列中没有可运行的任务, 就唤醒idle
-    if(list_empty(&thread_ready_list))
-        thread_unblock(idle_thread);
-    
-    // 尚未实现idle线程，因此有可能就绪队列为空
-    ASSERT(!list_empty(&thread_ready_list));
-    thread_tag = NULL;  // thread_tag清空
-    
-    // 将thread_ready_list队列中的第一个就绪线程弹出，准备将其调度上CPU
-    thread_tag = list_pop(&thread_ready_list);
-    struct task_struct *next = elem2entry(struct task_struct, general_tag, thread_tag);
+    // 如果就绪队列中没有可运行的任务, 就运行idle
+    struct task_struct *next = idle_thread;
+    if(ready_levels != 0)
+    {
+        // 弹出非空的最高级别就绪队列中的第一个就绪线程, 准备将其调度上CPU
+        unsigned int level = bit_scan_forward(ready_levels);
+        thread_tag = list_pop(&thread_ready_lists[level]);
+        if(list_empty(&thread_ready_lists[level]))
+            ready_levels &= ~(1 << level);
+        next = elem2entry(struct task_struct, general_tag, thread_tag);
+    }
     next->status = TASK_RUNNING;
     
     // 激活更新任务页表，如果是进程还需要需改TSS中的esp0
@@ -300,7 +388,10 @@ void thread_init(void)
 {
     put_str("thread_init begin...");
     
-    list_init(&thread_ready_list);  // 初始化就绪队列
+    unsigned int level;
+    for(level = 0; level < MLFQ_LEVELS; level++)
+        list_init(&thread_ready_lists[level]);  // 初始化各级别的就绪队列
+    ready_levels = 0;
     list_init(&thread_all_list);    // 初始化全部队列
     // lock_init(&pid_lock);           // 初始化锁，用于分配pid
     
@@ -352,12 +443,12 @@ void thread_unblock(struct task_struct *pthread)
         
     if(pthread->status != TASK_READY)   // 保险起见
     {
-        ASSERT(!elem_find(&thread_ready_list, &pthread->general_tag));  // 保险起见. ASSERT只是调试期间用
-        if(elem_find(&thread_ready_list, &pthread->general_tag))    // 保险起见
-            PANIC("[ERROR]thread_unblock: blocked thread in ready_list\n");
-        
-        // 加到就绪队列的队首，使其尽快得到调度，保证这个睡了很久的线程能被优先调度
-        list_push(&thread_ready_list, &pthread->general_tag);
+        // 等待I/O等事件的任务多是交互式的, 被唤醒时升一级并充满时间片, 使其尽快得到调度
+        // 加到该级别的队尾, 不插队到同级任务之前, 免得频繁被唤醒的任务饿死同级的任务
+        if(pthread->mlfq_level > 0)
+            pthread->mlfq_level--;
+        pthread->ticks = thread_time_slice(pthread);
+        thread_ready_append(pthread);
         pthread->status = TASK_READY;
     }
     
@@ -368,8 +459,8 @@ void thread_unblock(struct task_struct *pthread)
 
 /* idle线程, 系统空闲时运行的线程 */
 // idle_thread 线程在第一次创建时会被加入到就绪队列, 因此会执行一次, 然后阻塞;
-// 当就绪队列为空时, schedule会将 idle_thread 解除阻塞, 也就是唤醒 idle_thread,
-// idle_thread 会执行"sti hlt"先开中断, 再挂起CPU。
+// 当就绪队列为空时, schedule会直接让 idle_thread 上CPU, 它不再进入就绪队列,
+// idle_thread 先趁空闲预先清0一些空闲页框, 再执行"sti hlt"先开中断, 挂起CPU。
 static void idle(void *arg __attribute__((unused)))
 {
     while(1)
@@ -379,6 +470,12 @@ static void idle(void *arg __attribute__((unused)))
         // 并不是 jmp $ 那样空兜CPU, CPU利用率为100%
         thread_block(TASK_BLOCKED);
         
+        // 趁系统空闲, 为内存池补充预清0的页框, 一旦有任务就绪就停下
+        while(thread_ready_empty() && zero_page_fill())
+            ;
+        if(!thread_ready_empty())
+            continue;
+        
         // 执行hlt时必须要保证目前处于开中断的情况下
         // 处理器已经停止运行, 因此不会再产生内部异常, 唯一能唤醒处理器的就是外部中断
         asm volatile("sti; hlt" : : : "memory");
@@ -398,8 +495,7 @@ void thread_yield(void)
     struct task_struct *current = running_thread();
     enum intr_status old_status = intr_disable();
     
-    ASSERT(!elem_find(&thread_ready_list, &current->general_tag));
-    list_append(&thread_ready_list, &current->general_tag);
+    thread_ready_append(current);   // 保持级别和剩余的时间片
     current->status = TASK_READY;
     schedule();
     
@@ -503,28 +599,37 @@ void sys_ps(void)
 /* 回收 thread_over 的pcb 和页目录表, 并将其从调度队列中去除 */
 void thread_exit(struct task_struct *thread_over, bool need_schedule)
 {
+    // 内核线程的弹匣中缓存着内核堆的内存块, 要先归还
+    // 此处可能要获取内核内存池的锁, 故放在关中断之前
+    if(thread_over->pgdir == NULL)
+        mem_magazines_drain(thread_over);
+    
     // 要保证 schedule 在关中断情况下调用
     intr_disable();
     
     thread_over->status = TASK_DIED;
     
     // 如果 thread_over 不是当前线程, 就有可能还在就绪队列中, 将其从中删除
-    if(elem_find(&thread_ready_list, &thread_over->general_tag))
-        list_remove(&thread_over->general_tag);
+    if(elem_find(&thread_ready_lists[thread_over->mlfq_level], &thread_over->general_tag))
+        ready_list_remove(thread_over);
     
     if(thread_over->pgdir)  // 如果是进程, 回收进程的页目录表 一页框
+    {
+        page_dir_deactivate(thread_over->pgdir);
         mfree_page(PF_KERNEL, thread_over->pgdir, 1);
+    }
     
     // 从 all_thread_list 中去掉此任务
     list_remove(&thread_over->all_list_tag);
     
+    // pid要在回收pcb之前读出并释放, pcb所在页回收后就不可再访问
+    release_pid(thread_over->pid);
+    
     // 回收pcb所在的页, 主线程的pcb不在堆中, 跨过
     // 在laoder阶段指定在物理内存低端1MB中
     if(thread_over != main_thread)
         mfree_page(PF_KERNEL, thread_over, 1);
     
-    release_pid(thread_over->pid);
-    
     // 如果需要下一轮调度, 则主动调用 schedule
     // 调用 thread_exit 时, 有时候需要开始新调度, 不用回到主调函数; 
     // 有时候不需要新调度, 调用 thread_exit 后还要回到主调函数
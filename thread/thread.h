@@ -12,6 +12,11 @@ typedef void thread_func(void*);
 
 #define TASK_NAME_LEN               16
 
+/* 多级反馈队列调度: 级别0优先级最高, 级别越低时间片越长
+ * 用完整个时间片的任务降一级, 被唤醒的任务升一级, 每隔MLFQ_AGING_TICKS所有任务各升一级 */
+#define MLFQ_LEVELS                 4
+#define MLFQ_AGING_TICKS            100     // 1秒
+
 /* 进程/线程的6个状态 */
 enum task_status{
     TASK_RUNNING,
@@ -99,6 +104,7 @@ struct task_struct {
    unsigned char priority;		 // 线程优先级。优先级越高，时间片ticks越长
    /* 简单优先级调度的基础 */
    unsigned char ticks;     // 每次在处理器上执行的时间嘀嗒数
+   unsigned char mlfq_level;    // 所在的调度级别, 时间片为priority >> (MLFQ_LEVELS - 1 - mlfq_level)
    unsigned int elapsed_ticks;  // 执行了多久
    
    // general_tag是线程的标签，当线程被加入到就绪队列或其他等待队列中时
@@ -111,10 +117,23 @@ struct task_struct {
    unsigned int *pgdir;     // 进程页目录表的虚拟地址，如果该任务为线程则为NULL
                             // 寄存器CR3中加载的是页目录表的物理地址，所以后面还需要将pgdir转换为物理地址
                             
-   struct virtual_addr user_vaddr;  // 用户进程的虚拟地址位图
+   // 用户进程已占用的虚拟地址区域, 按起始地址排序
+   struct list vaddr_regions;
    
    // 用户进程内存块描述符, 本项目中定义了7种规格的内存块
    struct mem_block_desc u_block_desc[MEM_DESC_COUNT];  
+   struct mem_large_stat u_large_stat;  // 用户进程堆中的大块内存统计
+   
+   // 每种规格内存块的弹匣, 用户进程缓存的是自己堆中的内存块, 内核线程缓存的是内核堆中的内存块
+   struct mem_magazine mem_magazines[MEM_DESC_COUNT];
+   
+   // 用户进程按需分配页框的虚拟内存区域, 如从可执行文件加载的各段
+   struct list vm_areas;
+   
+   // 用户进程的brk堆[start_brk, brk), 紧接在程序的最后一个段之后, 由brk系统调用伸缩
+   // start_brk为0表示不是从可执行文件加载的进程, 首次调用brk时再确定堆的位置
+   unsigned int start_brk;
+   unsigned int brk;
    
    /* 文件描述符数组 */
    signed int fd_table[MAX_FILES_OPEN_PER_PROC];   
@@ -132,7 +151,6 @@ struct task_struct {
 };
 
 
-extern struct list thread_ready_list;
 extern struct list thread_all_list;
 
 
@@ -148,6 +166,13 @@ void thread_unblock(struct task_struct *pthread);
 
 void thread_yield(void);
 
+/* 就绪队列 */
+void thread_ready_append(struct task_struct *pthread);
+bool thread_ready_empty(void);
+unsigned char thread_time_slice(struct task_struct *pthread);
+bool thread_need_preempt(struct task_struct *current);
+void thread_aging(void);
+
 
 /* fork进程时为其分配pid,因为allocate_pid已经是静态的,别的文件无法调用.
  * 不想改变函数定义了,故定义fork_pid函数来封装一下。*/
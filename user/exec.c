@@ -4,6 +4,11 @@
 #include "fs.h"         // sys_close
 
 #include "string.h"     // memcpy
+#include "process.h"    // USER_STACK3_VADDR
+#include "wait_exit.h"  // sys_exit
+#include "file.h"       // file_table
+#include "vm_area.h"
+#include "vaddr_region.h"
 
 // DEBUG
 #include "stdio_kernel.h"
@@ -61,94 +66,78 @@ enum segment_type {
 };
 
 
-/* 将文件描述符 fd 指向的文件中, 偏移为offset, 大小为filesz的段加载到虚拟地址为vaddr的内存 */
-// filesz 为段的大小, 程序头中的段大小为 p_filesz
-// 程序是由多个段组成, 分别为每个可加载的段分配内存, 内存分配时采用页框粒度
-static bool segment_load(signed int fd, unsigned int offset, unsigned int filesz, unsigned int vaddr)
+/* 段的权限标志p_flags */
+#define PF_X    1   // 可执行
+#define PF_W    2   // 可写
+#define PF_R    4   // 可读
+
+
+/* 把程序头prog_header描述的可加载段映射为当前进程的虚拟内存区域, 段内容在fd指向的文件中
+ * 这里只登记区域并占用虚拟地址, 不分配页框也不读文件, 首次访问某页时由缺页异常从文件中读入该页 */
+// 段在内存中占 p_memsz 字节, 其中前 p_filesz 字节来自文件, 其余部分(如.bss)填0
+static bool segment_load(signed int fd, const struct Elf32_Phdr *prog_header)
 {
-    unsigned int vaddr_first_page = vaddr & 0xfffff000;     // vaddr 地址所在的页框
-    unsigned int size_in_first_page = PAGE_SIZE - (vaddr & 0x00000fff); // 加载到内存后, 文件在第一个页框中占用的字节大小
-    unsigned int occupy_pages = 0;
-    
-    // 第一个页框容不下该段
-    if(filesz > size_in_first_page)
-    {
-        unsigned int left_size = filesz - size_in_first_page;
-        occupy_pages = DIV_ROUND_UP(left_size, PAGE_SIZE) + 1;  // 1是指 vaddr_first_page
-    }
-    else
-    {
-        occupy_pages = 1;
-    }
+    struct task_struct *current = running_thread();
+    unsigned int vaddr = prog_header->p_vaddr;
+    unsigned int memsz = prog_header->p_memsz > prog_header->p_filesz ? \
+                         prog_header->p_memsz : prog_header->p_filesz;
+    unsigned int start = vaddr & 0xfffff000;
+    unsigned int end = DIV_ROUND_UP(vaddr + memsz, PAGE_SIZE) * PAGE_SIZE;
     
-    // 为进程分配内存
-    unsigned int page_index = 0;
-    unsigned int vaddr_page = vaddr_first_page;
-    while(page_index < occupy_pages)
-    {
-        unsigned int *pde = pde_ptr(vaddr_page);
-        unsigned int *pte = pte_ptr(vaddr_page);
-        
-        // 如果pde不存在,或者pte不存在就分配内存.
-        // pde的判断要在pte之前,否则pde若不存在会导致判断pte时缺页异常
-        if(!(*pde & 0x00000001) || !(*pte & 0x00000001))
-        {
-            if(get_a_page(PF_USER, vaddr_page) == NULL)
-                return false;
-        }
-        
-        // 如果原进程的页表已经分配了, 利用现有的物理页, 直接覆盖进程体
-        vaddr_page += PAGE_SIZE;
-        page_index++;
-    }
+    // 段须在用户虚拟地址池的范围内, 且不能与用户栈重叠
+    if(memsz == 0 || vaddr < USER_VADDR_START || end <= start || end > USER_STACK_BOTTOM)
+        return false;
     
-    sys_lseek(fd, offset, SEEK_SET);
+    struct vm_area *area = vm_area_create(current, start, end, \
+                                          prog_header->p_flags & PF_W ? VM_WRITE : 0, \
+                                          file_table[fd_local2global(fd)].fd_inode, \
+                                          prog_header->p_offset, vaddr, vaddr + prog_header->p_filesz);
+    if(area == NULL)
+        return false;
     
-    sys_read(fd, (void *)vaddr, filesz);
+    // 堆从最后一个段之后开始
+    if(end > current->start_brk)
+        current->start_brk = end;
     
-    return true;
+    // 占用段所在的虚拟地址, 免得被malloc分配出去. 相邻的段可能共用首尾页
+    return vaddr_region_reserve(current, start, (end - start) / PAGE_SIZE);
 }
 
 
-/* 从文件系统上加载用户程序pathname, 
- * 成功则返回程序的起始地址, 否则返回-1 */
-static signed int load(const char *pathname)
+/* 读出fd指向的文件的elf头并校验, 是可加载的elf可执行文件则返回true */
+static bool elf_header_check(signed int fd, struct Elf32_Ehdr *elf_header)
 {
-    signed int ret = -1;
-    struct Elf32_Ehdr elf_header;
-    struct Elf32_Phdr prog_header;
-    memset(&elf_header, 0, sizeof(struct Elf32_Ehdr));
-       
-    signed int fd = sys_open(pathname, O_RDONLY);
-    if(fd == -1)
-        return -1;
-    if(sys_read(fd, &elf_header, sizeof(struct Elf32_Ehdr)) != sizeof(struct Elf32_Ehdr))
-    {
-        ret = -1;
-        goto done;
-    }
+    memset(elf_header, 0, sizeof(struct Elf32_Ehdr));
+    if(sys_read(fd, elf_header, sizeof(struct Elf32_Ehdr)) != sizeof(struct Elf32_Ehdr))
+        return false;
     
     // 校验elf头
     // 判断加载的文件是否是elf格式
     // elf格式的魔数, 文件类型 ET_EXEC 为2, 体系结构 EM_386 为3, 版本信息 为1
     // 程序头表中条目的数量, 即段的个数   程序头表中每个条目的字节大小
-    if(memcmp(elf_header.e_ident, "\177ELF\1\1\1", 7) \
-        || elf_header.e_type != 2 \
-        || elf_header.e_machine != 3 \
-        || elf_header.e_version != 1 \
-        || elf_header.e_phnum > 1024 \
-        || elf_header.e_phentsize != sizeof(struct Elf32_Phdr))
-    {
-        ret = -1;
-        goto done;
-    }
+    if(memcmp(elf_header->e_ident, "\177ELF\1\1\1", 7) \
+        || elf_header->e_type != 2 \
+        || elf_header->e_machine != 3 \
+        || elf_header->e_version != 1 \
+        || elf_header->e_phnum > 1024 \
+        || elf_header->e_phentsize != sizeof(struct Elf32_Phdr))
+        return false;
+    return true;
+}
+
+
+/* 按elf头elf_header把fd指向的用户程序的各可加载段加载到内存, 
+ * 成功则返回程序的起始地址, 否则返回-1 */
+static signed int load(signed int fd, const struct Elf32_Ehdr *elf_header)
+{
+    struct Elf32_Phdr prog_header;
     
-    Elf32_Off prog_header_offset = elf_header.e_phoff;      // 程序头的起始地址
-    Elf32_Half prog_header_size = elf_header.e_phentsize;   // 程序头的条目大小
+    Elf32_Off prog_header_offset = elf_header->e_phoff;      // 程序头的起始地址
+    Elf32_Half prog_header_size = elf_header->e_phentsize;   // 程序头的条目大小
     
     // 遍历所有程序头
     unsigned int prog_index = 0;
-    while(prog_index < elf_header.e_phnum)  // 段的数量
+    while(prog_index < elf_header->e_phnum)  // 段的数量
     {
         memset(&prog_header, 0, prog_header_size);
         
@@ -157,67 +146,132 @@ static signed int load(const char *pathname)
         
         // 只获取程序头
         if(sys_read(fd, &prog_header, prog_header_size) != prog_header_size)
-        {
-            ret = -1;
-            goto done;
-        }
-
+            return -1;
         
-        // 如果是可加载段就调用segment_load加载到内存
+        // 如果是可加载段就调用segment_load映射到进程的虚拟内存区域
         if(PT_LOAD == prog_header.p_type)
         {
-            // segment_load 为该段分配内存, 从文件系统中加载到内存
-            if(!segment_load(fd, prog_header.p_offset, prog_header.p_filesz, prog_header.p_vaddr))
-            {
-                ret = -1;
-                goto done;
-            }
+            // segment_load 只登记该段, 段内容在首次访问时才从文件系统中读入内存
+            if(!segment_load(fd, &prog_header))
+                return -1;
         }
         
         // 更新下一个程序头的偏移
-        prog_header_offset += elf_header.e_phentsize;
+        prog_header_offset += elf_header->e_phentsize;
         prog_index++;
     }
-    // 处理完所有的段后, 将程序的入口赋值给ret
-    ret = elf_header.e_entry;
+    // 处理完所有的段后, 返回程序的入口
+    return elf_header->e_entry;
+}
+
+
+/* 把参数argv中的字符串依次复制到缓冲区buf, 参数个数存入argc
+ * 成功返回字符串的总字节数, 放不下则返回-1 */
+static signed int argv_save(char *buf, const char *argv[], unsigned int *argc)
+{
+    unsigned int size = 0;
+    *argc = 0;
+    while(argv[*argc])
+    {
+        unsigned int len = strlen(argv[*argc]) + 1;
+        // 新用户栈上还要放 argc+1 个指针
+        if(size + len + (*argc + 2) * sizeof(char *) > PAGE_SIZE)
+            return -1;
+        memcpy(buf + size, argv[*argc], len);
+        size += len;
+        (*argc)++;
+    }
+    return size;
+}
+
+
+/* 在新的用户栈顶部构建参数, 字符串在最上面, 其下是argv指针数组
+ * args为argv_save保存的argc个字符串, 共args_size字节. 成功返回用户空间中argv的地址, 否则返回NULL */
+// 栈页是按需分配的, 写入参数时由缺页异常分配栈顶的页
+static char **argv_build(const char *args, unsigned int args_size, unsigned int argc)
+{
+    if(!user_stack_create(running_thread()))
+        return NULL;
     
-done:
-    sys_close(fd);
-    return ret;
+    char *str = (char *)(0xc0000000 - args_size);
+    char **user_argv = (char **)(((unsigned int)str & ~3) - (argc + 1) * sizeof(char *));
+    memcpy(str, args, args_size);
+    
+    unsigned int arg_index;
+    for(arg_index = 0; arg_index < argc; arg_index++)
+    {
+        user_argv[arg_index] = str;
+        str += strlen(str) + 1;
+    }
+    user_argv[argc] = NULL;
+    return user_argv;
 }
 
+
 /* 用path指向的程序替换当前进程 */
+// 原进程体在加载新程序前整个释放. fork出的子进程与父进程写时复制共享的页,
+// 在这里只减少引用计数, 不会因为exec而被复制
 signed int sys_execv(const char *path, const char *argv[])
 {   
-    unsigned int argc = 0;
-    while(argv[argc])   // 统计出参数个数
-        argc++;
-   
-    // 加载文件
-    signed int entry_point = load(path);
-    if(entry_point == -1)   // 若加载失败则返回-1
+    // 先确认程序可以加载, 原进程体一旦释放就回不去了
+    struct Elf32_Ehdr elf_header;
+    signed int fd = sys_open(path, O_RDONLY);
+    if(fd == -1)
         return -1;
-       
+    if(!elf_header_check(fd, &elf_header))
+    {
+        sys_close(fd);
+        return -1;
+    }
+    
+    // 参数可能就在即将释放的用户空间中, 先保存到内核
+    unsigned int argc;
+    char *args = get_kernel_pages(1);
+    signed int args_size = args == NULL ? -1 : argv_save(args, argv, &argc);
+    if(args_size == -1)
+    {
+        if(args != NULL)
+            free_kernel_pages(args, 1);
+        sys_close(fd);
+        return -1;
+    }
+    
     struct task_struct *current = running_thread();
-
     
     // 修改进程名
     memcpy(current->name, path, TASK_NAME_LEN);
     current->name[TASK_NAME_LEN-1] = 0;
     
+    // 释放原进程体及其区域, 清空虚拟地址池及堆
+    vm_areas_sync(current, 0, 0xc0000000);  // 共享文件映射中改过的页写回文件
+    release_user_space();
+    vm_areas_release(current);
+    vaddr_regions_release(current);
+    block_desc_init(current->u_block_desc);
+    memset(current->mem_magazines, 0, sizeof(current->mem_magazines));
+    memset(&current->u_large_stat, 0, sizeof(current->u_large_stat));
+    current->start_brk = 0;
+    
+    // 加载文件
+    signed int entry_point = load(fd, &elf_header);
+    sys_close(fd);
+    current->brk = current->start_brk;
+    char **user_argv = entry_point == -1 ? NULL : argv_build(args, args_size, argc);
+    free_kernel_pages(args, 1);
+    if(user_argv == NULL)   // 原进程体已经没了, 加载失败只能退出
+        sys_exit(-1);
+    
     // 内核栈
     // 接下来需要利用该栈从 intr_exit 返回
     struct intr_stack *intr_0_stack = (struct intr_stack *)((unsigned int)current + PAGE_SIZE - sizeof(struct intr_stack));
     // 参数传递给用户进程
-    intr_0_stack->ebx = (signed int)argv;       // 参数数组argv的地址
+    intr_0_stack->ebx = (signed int)user_argv;  // 参数数组argv的地址
     intr_0_stack->ecx = argc;                   // 参数个数
                                 // 新进程从 intr_exit 返回后才是第一次运行, 因此运行之处通用寄存器中的值都是无效的
                                 // 只有运行之后寄存器中的值才是有意义的
     intr_0_stack->eip = (void *)entry_point; // 将可执行文件的入口地址赋值给eip    
     
-    intr_0_stack->esp = (void *)0xc0000000; // 使新用户进程的栈地址为最高用户空间地址
-                                            // 老进程用户栈中的数据对新进程没用
-                                            // 用户空间的最高处用于存储命令行参数
+    intr_0_stack->esp = user_argv;  // 用户栈的最高处存放着命令行参数, 新进程的栈从其下开始
     
     // exec 不同于fork, 为使新进程更快被执行, 直接从中断返回
     // 将新进程内核栈地址赋值给esp, 跳转到 intr_exit, 假装从中断返回, 实现了新进程的运行
@@ -225,7 +279,3 @@ signed int sys_execv(const char *path, const char *argv[])
     
     return 0;   // exec使程序一去不回头, 这里根本没机会执行, 只是为了满足编译器语法要求
 }
-
-
-
-
@@ -12,12 +12,15 @@
 #include "global.h"     // NULL
 
 #include "pipe.h"       // is_pipe
+#include "vm_area.h"    // vm_areas_copy vm_areas_release
+#include "vaddr_region.h"   // vaddr_regions_copy vaddr_regions_release
+#include "memory.h"     // cow_share_user_space cow_unshare_user_space mfree_page
 
 extern void intr_exit(void);
 
 
-/* 将父进程的PCB 虚拟地址位图拷贝给子进程 */
-static signed int copy_pcb_vaddr_bitmap_stack0(struct task_struct *child_thread, struct task_struct *parent_thread)
+/* 将父进程的PCB及内核栈拷贝给子进程 */
+static signed int copy_pcb_stack0(struct task_struct *child_thread, struct task_struct *parent_thread)
 {
 // a) 复制PCB所在的整个页, 里面包含进程PCB信息及特权0级的栈, 里面包含了返回地址
 //    然后再单独修改个别部分
@@ -26,25 +29,29 @@ static signed int copy_pcb_vaddr_bitmap_stack0(struct task_struct *child_thread,
     child_thread->pid = fork_pid();     // thread/thread.c 中, 仅是allocate_pid的封装
     child_thread->elapsed_ticks = 0;
     child_thread->status = TASK_READY;
-    child_thread->ticks = child_thread->priority;   // 为子进程把时间片充满
+    child_thread->ticks = thread_time_slice(child_thread);  // 为子进程把时间片充满, 级别与父进程相同
     child_thread->parent_pid = parent_thread->pid;
     
     child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
     child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
     
+    // 页目录和区域链表随后再建, 先置空, fork中途失败时fork_undo据此判断哪些已建好
+    child_thread->pgdir = NULL;
+    list_init(&child_thread->vm_areas);
+    
     // 初始化进程自己的内存块描述符, 本项目中定义了7种规格的内存块
     // 如果没初始化的话, 则将继承父进程的块描述符, 子进程分配内存时会导致缺页异常
     block_desc_init(child_thread->u_block_desc);     
-    
-// b) 复制父进程的虚拟地址池的位图
-    unsigned int bitmap_page_count = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PAGE_SIZE / 8, PAGE_SIZE);
-    void *vaddr_bitmap = get_kernel_pages(bitmap_page_count); // 在内核中 ?
-    if(vaddr_bitmap == NULL)
+    // 子进程的堆中有父进程的全部arena, arena数照旧; 大块内存的统计随PCB一起复制过来了
+    unsigned int desc_index;
+    for(desc_index = 0; desc_index < MEM_DESC_COUNT; desc_index++)
+        child_thread->u_block_desc[desc_index].arena_count = parent_thread->u_block_desc[desc_index].arena_count;
+    // 父进程弹匣中缓存的内存块属于父进程的块描述符, 子进程不能继承
+    memset(child_thread->mem_magazines, 0, sizeof(child_thread->mem_magazines));
+    
+// b) 子进程的区域链表还挂着父进程的结点, 复制一份自己的
+    if(!vaddr_regions_copy(child_thread, parent_thread))
         return -1;
-/* 此时child_thread->user_vaddr.vaddr_bitmap.bits还是指向父进程虚拟地址的位图地址
- * 下面将child_thread->user_vaddr.vaddr_bitmap.bits指向自己的位图vaddr_btmp */    
-    memcpy(vaddr_bitmap, child_thread->user_vaddr.vaddr_bitmap.bits, bitmap_page_count * PAGE_SIZE);
-    child_thread->user_vaddr.vaddr_bitmap.bits = vaddr_bitmap;
     
     // 调试用, 调试后删除。(父子进程应该是同名的)
     // ASSERT(strlen(child_thread->name) < 11);    // pcb.name的长度是16, 为避免下面strcat越界
@@ -54,66 +61,11 @@ static signed int copy_pcb_vaddr_bitmap_stack0(struct task_struct *child_thread,
 }
 
 
-/* 复制子进程的进程体(代码和数据)及用户栈 */
-// 拷贝进程的代码和数据资源, 也就是复制一份进程体
-// 各用户进程的低3GB空间是独立的, 各用户进程不能互相访问彼此的空间, 但高1GB是内核空间,
-// 因此, 借助内核空间作为数据中转。高1GB是内核空间, 内核空间是所有用户进程共享的
-// 由于用户栈位于低3GB虚拟空间中的最高处, 所以循环到最后时会完成用户栈的复制
-static void copy_body_stack3(struct task_struct *child_thread, struct task_struct *parent_thread, void *buf_page)
-{
-    unsigned char *vaddr_bitmap = parent_thread->user_vaddr.vaddr_bitmap.bits;
-    unsigned int bitmap_bytes_len = parent_thread->user_vaddr.vaddr_bitmap.bitmap_bytes_len;
-    unsigned int vaddr_begin = parent_thread->user_vaddr.vaddr_begin;
-    
-    /* 在父进程的用户空间中查找已有数据的页 */
-    // 只拷贝用户空间中有效的部分, 即有数据的部分
-    // 为节省缓冲区空间, 在父进程虚拟地址空间中每找到一页, 就在子进程虚拟地址空间中分配一页,
-    // 一页一页的拷贝
-    unsigned int index_byte = 0;
-    while(index_byte < bitmap_bytes_len)    // 逐字节查看位图
-    {
-        if(vaddr_bitmap[index_byte])    // 该字节不为0
-        {
-            unsigned int index_bit = 0;
-            while(index_bit < 8)
-            {
-                if((1 << index_bit) & vaddr_bitmap[index_byte])   // 逐位查看
-                {
-                    // 将该位转换为对应的虚拟地址
-                    unsigned int user_vaddr = (index_byte * 8 + index_bit) * PAGE_SIZE + vaddr_begin;
-                    
-                    // 下面的操作是将父进程用户空间中的数据通过内核空间做中转, 最终复制到子进程的用户空间
-                    
-                    // a) 将父进程在用户空间中的数据复制到内核缓冲区buf_page, 
-                    //    目的是下面切换到子进程的页表后, 还能访问到父进程的数据
-                    memcpy(buf_page, (void *)user_vaddr, PAGE_SIZE);
-                    
-                    // b) 将页表切换到子进程, 目的是避免下面申请内存的函数将pte及pde安装在父进程的页表中
-                    // 一定要将页表替换为子进程的页表
-                    page_dir_activate(child_thread);    // 激活子进程的页表
-                    
-                    // c) 申请虚拟地址
-                    get_a_page_without_operate_vaddrbitmap(PF_USER, user_vaddr);
-                    
-                    // d) 从内核缓冲区中将父进程数据复制到子进程的用户空间
-                    memcpy((void *)user_vaddr, buf_page, PAGE_SIZE);
-                    
-                    // e) 恢复父进程页表, 继续寻找父进程占用的虚拟空间
-                    page_dir_activate(parent_thread);
-                }
-                index_bit++;
-            }
-        }
-        index_byte++;
-    }
-}
-
-
 /* 为子进程构建thread_stack和修改返回值 */
 // 父进程执行fork系统调用时会进入内核态, 中断入口程序会保存父进程的上下文,
 // 这其中包括进程在用户态下的 cs:eip, 父进程从fork系统调用返回后, 可以继续执行fork之后的代码
 
-// copy_pcb_vaddr_bitmap_stack0 中将父进程的内核栈复制到了子进程的内核栈中, 那里保存了返回地址, 也就是fork之后的地址,
+// copy_pcb_stack0 中将父进程的内核栈复制到了子进程的内核栈中, 那里保存了返回地址, 也就是fork之后的地址,
 // 为了让子进程也能继续fork之后的代码运行, 必须让他同父进程一样, 从中断退出, 
 //也就是要经过 intr_exit
 // 子进程是由调度器 schedule 调度执行的, 它要用到 switch_to 函数, 而switch_to要从栈
@@ -194,13 +146,8 @@ static void update_inode_open_counts(struct task_struct *thread)
 // 是前面函数的封装
 static signed int copy_process(struct task_struct *child_thread, struct task_struct *parent_thread)
 {
-    // 内核缓冲区, 作为父进程用户空间的数据复制到子进程用户空间的中转
-    void *buf_page = get_kernel_pages(1);
-    if(buf_page == NULL)
-        return -1;
-    
-    // a) 复制父进程的PCB、虚拟地址位图、内核栈到子进程
-    if(copy_pcb_vaddr_bitmap_stack0(child_thread, parent_thread) == -1)
+    // a) 复制父进程的PCB、虚拟地址区域、内核栈到子进程
+    if(copy_pcb_stack0(child_thread, parent_thread) == -1)
         return -1;
     
     // b) 为子进程创建页表, 此页表仅包括内核空间
@@ -208,8 +155,12 @@ static signed int copy_process(struct task_struct *child_thread, struct task_str
     if(child_thread->pgdir == NULL)
         return -1;
     
-    // c) 复制父进程进程体及用户栈给子进程
-    copy_body_stack3(child_thread, parent_thread, buf_page);
+    // c) 子进程与父进程写时复制地共享进程体及用户栈, 不必逐页复制
+    if(!cow_share_user_space(child_thread->pgdir))
+        return -1;
+    // 尚未访问过的页还没有分配, 子进程要继承父进程的区域, 以便按需分配
+    if(!vm_areas_copy(child_thread, parent_thread))
+        return -1;
     
     // d) 构建子进程thread_stack和修改返回值pid
     build_child_stack(child_thread);
@@ -217,12 +168,28 @@ static signed int copy_process(struct task_struct *child_thread, struct task_str
     // e) 更新文件inode的打开数
     update_inode_open_counts(child_thread);
     
-    mfree_page(PF_KERNEL, buf_page, 1);
     return 0;
 }
 
 
 
+/* fork中途失败时, 归还子进程已得到的资源: 区域持有的inode和共享内存段挂接数、
+ * 页表及其对页框和交换槽的引用、页目录、pid和PCB */
+static void fork_undo(struct task_struct *child_thread)
+{
+    vm_areas_release(child_thread);
+    vaddr_regions_release(child_thread);
+    if(child_thread->pgdir != NULL)
+    {
+        cow_unshare_user_space(child_thread->pgdir);
+        mfree_page(PF_KERNEL, child_thread->pgdir, 1);
+    }
+    release_pid(child_thread->pid);
+    mfree_page(PF_KERNEL, child_thread, 1);
+}
+
+
+
 /* fork子进程, 内核线程不可直接调用 */
 // 克隆当前进程, 即父进程
 signed short int sys_fork(void)
@@ -235,11 +202,13 @@ signed short int sys_fork(void)
     ASSERT(INTR_OFF == intr_get_status() && parent_thread->pgdir != NULL);
     
     if(copy_process(child_thread, parent_thread) == -1)
+    {
+        fork_undo(child_thread);
         return -1;
+    }
     
     // 添加到就绪线程队列和所有线程队列, 子进程由调度器安排运行
-    ASSERT(!elem_find(&thread_ready_list, &child_thread->general_tag));
-    list_append(&thread_ready_list, &child_thread->general_tag);
+    thread_ready_append(child_thread);
     ASSERT(!elem_find(&thread_all_list, &child_thread->all_list_tag));
     list_append(&thread_all_list, &child_thread->all_list_tag);
     
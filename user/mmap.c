@@ -0,0 +1,191 @@
+#include "mmap.h"
+
+#include "thread.h"     // running_thread
+#include "memory.h"     // free_user_pages
+#include "vm_area.h"
+#include "vaddr_region.h"
+#include "global.h"     // DIV_ROUND_UP
+#include "fs.h"         // fd_local2global O_WRONLY
+#include "file.h"       // file_table
+#include "inode.h"      // struct inode
+#include "pipe.h"       // is_pipe
+#include "process.h"    // USER_VADDR_START USER_STACK_BOTTOM
+
+
+/* 取mmap参数中文件描述符fd对应的inode, fd须是为读打开的普通文件, 共享可写的映射还须能写
+ * 不符合要求返回NULL */
+static struct inode *mmap_file_inode(const struct mmap_args *args)
+{
+    signed int fd = args->fd;
+    if(fd <= stderr_id || fd >= MAX_FILES_OPEN_PER_PROC || running_thread()->fd_table[fd] == -1 || is_pipe(fd))
+        return NULL;
+    
+    struct file *file = &file_table[fd_local2global(fd)];
+    if(file->fd_flag == O_WRONLY)
+        return NULL;
+    if((args->flags & MAP_SHARED) && (args->prot & PROT_WRITE) && !(file->fd_flag & (O_WRONLY | O_RDWR)))
+        return NULL;
+    return file->fd_inode;
+}
+
+
+/* 在当前进程的地址空间中建立映射, 成功返回映射的起始地址, 失败返回MAP_FAILED
+ * 私有映射的页在首次访问时才分配页框并从文件读入, 读未写过的匿名页时映射共享的零页;
+ * 共享映射的页要在fork后仍由父子进程共用, 因此在mmap时就全部分配好 */
+void *sys_mmap(const struct mmap_args *args)
+{
+    struct task_struct *current = running_thread();
+    
+    // MAP_SHARED与MAP_PRIVATE须二选一, 不支持指定地址
+    bool shared = args->flags & MAP_SHARED;
+    if(current->pgdir == NULL || shared == !!(args->flags & MAP_PRIVATE) || (args->flags & MAP_FIXED))
+        return MAP_FAILED;
+    if(args->length == 0 || args->length > 0xc0000000 || args->offset % PAGE_SIZE != 0)
+        return MAP_FAILED;
+    
+    struct inode *inode = NULL;
+    if(!(args->flags & MAP_ANONYMOUS) && (inode = mmap_file_inode(args)) == NULL)
+        return MAP_FAILED;
+    
+    unsigned int page_count = DIV_ROUND_UP(args->length, PAGE_SIZE);
+    unsigned int start = vaddr_region_alloc(current, page_count);
+    if(start == 0)
+        return MAP_FAILED;
+    unsigned int end = start + page_count * PAGE_SIZE;
+    
+    // 映射范围超出文件末尾的部分填0
+    unsigned int file_bytes = 0;
+    if(inode != NULL && args->offset < inode->inode_size)
+        file_bytes = inode->inode_size - args->offset < args->length ? \
+                     inode->inode_size - args->offset : args->length;
+    
+    unsigned int flags = VM_MMAP | (args->prot & PROT_WRITE ? VM_WRITE : 0) | (shared ? VM_SHARED : 0);
+    if(vm_area_create(current, start, end, flags, inode, args->offset, start, start + file_bytes) == NULL)
+    {
+        vaddr_region_remove(current, start, page_count);
+        return MAP_FAILED;
+    }
+    
+    unsigned int page = start;
+    while(shared && page < end)
+    {
+        if(!vm_area_fault(page, false))
+        {
+            sys_munmap((void *)start, args->length);
+            return MAP_FAILED;
+        }
+        page += PAGE_SIZE;
+    }
+    return (void *)start;
+}
+
+
+/* [start, end)是否全部落在当前进程由mmap建立的区域中 */
+static bool mmap_range_check(struct task_struct *pthread, unsigned int start, unsigned int end)
+{
+    unsigned int covered = 0;
+    struct list_elem *elem = pthread->vm_areas.head.next;
+    while(elem != &pthread->vm_areas.tail)
+    {
+        struct vm_area *area = elem2entry(struct vm_area, area_tag, elem);
+        if(area->start < end && area->end > start)
+        {
+            // 不能解除程序的代码段、数据段、栈或malloc的内存
+            if(!(area->flags & VM_MMAP))
+                return false;
+            covered += (area->end < end ? area->end : end) - (area->start > start ? area->start : start);
+        }
+        elem = elem->next;
+    }
+    return covered == end - start;
+}
+
+
+/* 解除当前进程中以addr起始的length字节的映射, 成功返回0, 失败返回-1
+ * 可以只解除一次mmap的一部分, 已分配的页框随之释放 */
+signed int sys_munmap(void *addr, unsigned int length)
+{
+    struct task_struct *current = running_thread();
+    unsigned int start = (unsigned int)addr;
+    if(current->pgdir == NULL || start % PAGE_SIZE != 0 || length == 0 || start >= 0xc0000000 || \
+       length > 0xc0000000 - start)
+        return -1;
+    
+    unsigned int page_count = DIV_ROUND_UP(length, PAGE_SIZE);
+    unsigned int end = start + page_count * PAGE_SIZE;
+    if(!mmap_range_check(current, start, end))
+        return -1;
+    
+    // 共享文件映射中改过的页先写回文件
+    vm_areas_sync(current, start, end);
+    if(!vm_area_remove_range(current, start, end))
+        return -1;
+    
+    free_user_pages(addr, page_count);
+    return 0;
+}
+
+
+/* 把当前进程中以addr起始的length字节内, 共享文件映射里改过的页写回文件
+ * 成功返回0, 范围不全是mmap建立的映射或写回失败返回-1. flags目前不区分同步与异步 */
+signed int sys_msync(void *addr, unsigned int length, signed int flags)
+{
+    struct task_struct *current = running_thread();
+    unsigned int start = (unsigned int)addr;
+    if(current->pgdir == NULL || start % PAGE_SIZE != 0 || length == 0 || start >= 0xc0000000 || \
+       length > 0xc0000000 - start)
+        return -1;
+    (void)flags;
+    
+    unsigned int end = start + DIV_ROUND_UP(length, PAGE_SIZE) * PAGE_SIZE;
+    if(!mmap_range_check(current, start, end) || !vm_areas_sync(current, start, end))
+        return -1;
+    return 0;
+}
+
+
+/* 把当前进程堆的结束地址调整为new_brk, 返回调整后的结束地址
+ * new_brk为0或无法调整(低于堆的起始地址、与已占用的地址重叠或内存不足)时不做调整, 返回当前的结束地址
+ * 堆中新增的页首次访问时才分配清0的页框, 缩小时归还的页框随之释放 */
+unsigned int sys_brk(unsigned int new_brk)
+{
+    struct task_struct *current = running_thread();
+    if(current->pgdir == NULL)
+        return 0;
+    
+    // 不是从可执行文件加载的进程没有程序段, 堆从用户虚拟地址的起始处开始
+    if(current->start_brk == 0)
+        current->start_brk = current->brk = USER_VADDR_START;
+    if(new_brk < current->start_brk || new_brk > USER_STACK_BOTTOM)
+        return current->brk;
+    
+    // 堆按页占用虚拟地址, 结束地址不必按页对齐
+    unsigned int old_end = DIV_ROUND_UP(current->brk, PAGE_SIZE) * PAGE_SIZE;
+    unsigned int new_end = DIV_ROUND_UP(new_brk, PAGE_SIZE) * PAGE_SIZE;
+    if(new_end > old_end)
+    {
+        unsigned int page_count = (new_end - old_end) / PAGE_SIZE;
+        if(!vaddr_region_available(current, old_end, page_count) || \
+           !vaddr_region_reserve(current, old_end, page_count))
+            return current->brk;
+        
+        // 与堆中已有的匿名区域相接时直接延长它, 免得每次扩大都新建一个区域
+        struct vm_area *area = old_end > current->start_brk ? vm_area_find(current, old_end - PAGE_SIZE) : NULL;
+        if(area != NULL && area->end == old_end && area->inode == NULL && area->flags == VM_WRITE)
+            area->end = new_end;
+        else if(vm_area_create(current, old_end, new_end, VM_WRITE, NULL, 0, 0, 0) == NULL)
+        {
+            vaddr_region_remove(current, old_end, page_count);
+            return current->brk;
+        }
+    }
+    else if(new_end < old_end)
+    {
+        if(!vm_area_remove_range(current, new_end, old_end))
+            return current->brk;
+        free_user_pages((void *)new_end, (old_end - new_end) / PAGE_SIZE);
+    }
+    
+    current->brk = new_brk;
+    return new_brk;
+}
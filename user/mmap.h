@@ -0,0 +1,37 @@
+#ifndef __USER_MMAP_H
+#define __USER_MMAP_H
+
+/* mmap的内存保护属性prot, 本项目的页表只能区分可写与只读 */
+#define PROT_NONE       0
+#define PROT_READ       1
+#define PROT_WRITE      2
+#define PROT_EXEC       4
+
+/* mmap的映射方式flags */
+#define MAP_SHARED      1
+#define MAP_PRIVATE     2
+#define MAP_FIXED       0x10
+#define MAP_ANONYMOUS   0x20
+
+#define MAP_FAILED      ((void *)-1)
+
+/* msync的flags */
+#define MS_ASYNC        1
+#define MS_SYNC         4
+
+/* mmap有6个参数, 而系统调用最多用寄存器传3个参数, 因此打包成结构体传其地址 */
+struct mmap_args{
+    void *addr;             // 期望的起始地址, 目前只作提示, 不会采用
+    unsigned int length;    // 映射的字节数, 向上取整到页
+    signed int prot;        // PROT_*
+    signed int flags;       // MAP_*
+    signed int fd;          // 映射的文件, 匿名映射时忽略
+    unsigned int offset;    // 文件中的起始偏移, 须按页对齐
+};
+
+void *sys_mmap(const struct mmap_args *args);
+signed int sys_munmap(void *addr, unsigned int length);
+signed int sys_msync(void *addr, unsigned int length, signed int flags);
+unsigned int sys_brk(unsigned int new_brk);
+
+#endif
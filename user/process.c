@@ -2,6 +2,8 @@
 
 
 #include "memory.h"
+#include "vm_area.h"
+#include "vaddr_region.h"
 #include "tss.h"
 
 #include "debug.h"
@@ -55,8 +57,10 @@ static void start_process(void *filename)
     proc_stack->cs = SELECTOR_U_CODE;
     proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);
     
-    // 为用户进程分配3特权级下的栈，从用户内存池中分配的地址
-    proc_stack->esp = (void *)((unsigned int)get_a_page(PF_USER, USER_STACK3_VADDR) + PAGE_SIZE);
+    // 为用户进程登记3特权级下的栈，栈页在用到时才从用户内存池中分配
+    if(!user_stack_create(current))
+        PANIC("start_process: user_stack_create failed!");
+    proc_stack->esp = (void *)0xc0000000;
     proc_stack->ss = SELECTOR_U_DATA;
     
     /* 一般情况下，CPU不允许从高特权级转向低特权级，除非是从中断和调用门返回的情况下 */
@@ -68,30 +72,62 @@ static void start_process(void *filename)
 }
 
 
+/* 为进程pthread登记用户栈区域[USER_STACK_BOTTOM, 0xc000_0000), 成功返回true
+ * 栈向下增长, 访问到栈区域中尚未分配的页时由缺页异常按需分配, 超出栈区域才是真正的栈溢出 */
+bool user_stack_create(struct task_struct *pthread)
+{
+    if(vm_area_create(pthread, USER_STACK_BOTTOM, 0xc0000000, VM_WRITE, NULL, 0, 0, 0) == NULL)
+        return false;
+    return vaddr_region_reserve(pthread, USER_STACK_BOTTOM, USER_STACK_SIZE / PAGE_SIZE);
+}
+
+
 /* 不同的进程在执行前，需要更新CR3寄存器为与之配套的页表，从而实现虚拟地址空间的隔离 */
 
+// 本项目中在loader.asm开启分页机制时，就已将内核的页目录和页表存放在1MB之上(基地址为0x10_0000)
+#define KERNEL_PAGE_DIR_PHY_ADDR    0x100000
+
+// 当前cr3中页目录表的物理地址
+static unsigned int active_pagedir_phy_addr = KERNEL_PAGE_DIR_PHY_ADDR;
+
 /* 激活页表
  * 更新页目录表寄存器cr3, 使新页表生效 */
 void page_dir_activate(struct task_struct *pthread)
 {
 /********************************************************
  * 执行此函数时,当前任务可能是线程。
- * 之所以对线程也要重新安装页表, 原因是上一次被调度的可能是进程,
- * 否则不恢复页表的话,线程就会使用进程的页表了。
+ * 各页目录表中内核空间的页目录项都相同, 而内核线程只访问内核空间,
+ * 因此内核线程直接借用上一个任务的页表, 不必切换回内核的页目录表。
+ * 写cr3会清空TLB中用户空间的条目, 只有页目录表真的变了才写。
  ********************************************************/
-
-/* 若为内核线程，需要重新填充页表为0x10_0000 */
-// 默认为内核的页目录物理地址，也就是内核线程所用的页目录表
-// 本项目中在loader.asm开启分页机制时，就已将内核的页目录和页表存放在1MB之上(基地址为0x10_0000)
-    unsigned int pagedir_phy_addr = 0x100000;  
-    if(pthread->pgdir != NULL)  // 用户态进程有自己的页目录表
-        // pgdir为页表的虚拟地址，而cr3存储的是物理地址
-        pagedir_phy_addr = addr_v2p((unsigned int)pthread->pgdir);
+    if(pthread->pgdir == NULL)
+        return;
+    
+    // pgdir为页表的虚拟地址，而cr3存储的是物理地址
+    unsigned int pagedir_phy_addr = addr_v2p((unsigned int)pthread->pgdir);
+    if(pagedir_phy_addr == active_pagedir_phy_addr)
+        return;
+    
     // 更新页目录寄存器cr3, 使新页表生效
+    active_pagedir_phy_addr = pagedir_phy_addr;
     asm volatile("movl %0, %%cr3" : : "r"(pagedir_phy_addr) : "memory"); // 切换页表
 }
 
 
+/* 释放页目录表pgdir前调用, 若它还在cr3中(可能正被内核线程借用), 先换回内核的页目录表 */
+// 否则此页框被分配给新进程作页目录表时, 会被误认为已经激活
+void page_dir_deactivate(unsigned int *pgdir)
+{
+    enum intr_status old_status = intr_disable();
+    if(addr_v2p((unsigned int)pgdir) == active_pagedir_phy_addr)
+    {
+        active_pagedir_phy_addr = KERNEL_PAGE_DIR_PHY_ADDR;
+        asm volatile("movl %0, %%cr3" : : "r"(active_pagedir_phy_addr) : "memory");
+    }
+    intr_set_status(old_status);
+}
+
+
 /* 激活线程/进程的页表
  * 更新TSS中的esp0为进程的特权级0的栈 */
 void process_activate(struct task_struct *pthread)
@@ -140,19 +176,6 @@ unsigned int *create_page_dir(void)
 }
 
 
-/* 创建用户进程虚拟地址位图 */
-static void create_user_vaddr_bitmap(struct task_struct *user_prog)
-{
-    // readelf -e可查看可执行程序的"Entry Point Address"
-    user_prog->user_vaddr.vaddr_begin = USER_VADDR_START;   // 用户进程的起始地址0x0804_8000
-    // 0xc000_0000为3G
-    unsigned int bitmap_page_count = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PAGE_SIZE / 8, PAGE_SIZE);
-    // 存放位图bitmap的起始地址
-    user_prog->user_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_page_count);
-    user_prog->user_vaddr.vaddr_bitmap.bitmap_bytes_len = (0xc0000000 - USER_VADDR_START) / PAGE_SIZE / 8;
-    bitmap_init(&user_prog->user_vaddr.vaddr_bitmap);
-}
-
 /* 创建用户进程，并加入就绪队列 */
 // 参数filename 用户进程地址, name 进程名
 void process_execute(void *filename, char *name)
@@ -161,7 +184,6 @@ void process_execute(void *filename, char *name)
     struct task_struct *thread = get_kernel_pages(1);
     
     init_thread(thread, name, default_prio);
-    create_user_vaddr_bitmap(thread);
     thread_create(thread, start_process, filename);
     thread->pgdir = create_page_dir();
     
@@ -169,8 +191,7 @@ void process_execute(void *filename, char *name)
     
     enum intr_status old_status = intr_disable();   // 关中断
     
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-    list_append(&thread_ready_list, &thread->general_tag);
+    thread_ready_append(thread);
     
     ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
     list_append(&thread_all_list, &thread->all_list_tag);
@@ -8,10 +8,15 @@
 #define USER_STACK3_VADDR   (0xc0000000 - 0x1000)
 #define USER_VADDR_START    0x8048000   // 即128M
 
+/* 用户栈最大8MB, 整个栈区域预先登记为已占用, 栈页在首次访问时才分配 */
+#define USER_STACK_SIZE     0x800000
+#define USER_STACK_BOTTOM   (0xc0000000 - USER_STACK_SIZE)
+
 #define default_prio        31
 
 void process_activate(struct task_struct *pthread);
 void process_execute(void *filename, char *name);
+bool user_stack_create(struct task_struct *pthread);
 
 
 /* 创建页目录表，并复制内核1G空间对应的页目录项
@@ -24,6 +29,7 @@ unsigned int *create_page_dir(void);
 /* 激活页表
  * 更新页目录表寄存器cr3, 使新页表生效 */
 void page_dir_activate(struct task_struct *pthread);
+void page_dir_deactivate(unsigned int *pgdir);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,219 @@
+#include "shm.h"
+
+#include "thread.h"     // running_thread
+#include "memory.h"
+#include "vm_area.h"
+#include "vaddr_region.h"
+#include "sync.h"       // struct lock
+#include "debug.h"      // ASSERT
+#include "global.h"     // DIV_ROUND_UP
+
+/* 共享内存段 */
+struct shm_segment{
+    signed int key;             // 键, IPC_PRIVATE的段不能按键查找
+    unsigned int page_count;    // 段的页数, 为0表示此表项空闲
+    unsigned int *frames;       // 各页的物理地址, 段自身持有每个页框的一次引用
+    unsigned int attach_count;  // 挂接了此段的区域数
+    bool removed;               // 已被IPC_RMID删除, 不能再被找到和挂接
+};
+
+static struct shm_segment shm_table[MAX_SHM_SEGMENTS];
+static struct lock shm_lock;    // 操作shm_table时互斥
+
+
+/* 初始化共享内存段表 */
+void shm_init(void)
+{
+    lock_init(&shm_lock);
+}
+
+
+/* 释放段seg的页框及页框地址数组, 表项随之空闲 */
+static void shm_segment_free(struct shm_segment *seg)
+{
+    unsigned int page_index;
+    for(page_index = 0; page_index < seg->page_count; page_index++)
+    {
+        if(seg->frames[page_index] != 0)
+            free_a_phy_page(seg->frames[page_index]);
+    }
+    free_kernel_pages(seg->frames, 1);
+    seg->page_count = 0;
+}
+
+
+/* fork时子进程继承了挂接着段shm_id的区域, 段的挂接数加1 */
+void shm_attach_get(signed int shm_id)
+{
+    ASSERT(shm_id >= 0 && shm_id < MAX_SHM_SEGMENTS && shm_table[shm_id].page_count != 0);
+    lock_acquire(&shm_lock);
+    shm_table[shm_id].attach_count++;
+    lock_release(&shm_lock);
+}
+
+
+/* 挂接着段shm_id的区域被释放, 段的挂接数减1, 已删除的段没有进程挂接时释放 */
+void shm_attach_put(signed int shm_id)
+{
+    ASSERT(shm_id >= 0 && shm_id < MAX_SHM_SEGMENTS);
+    struct shm_segment *seg = &shm_table[shm_id];
+    ASSERT(seg->page_count != 0 && seg->attach_count > 0);
+    lock_acquire(&shm_lock);
+    if(--seg->attach_count == 0 && seg->removed)
+        shm_segment_free(seg);
+    lock_release(&shm_lock);
+}
+
+
+/* 新建一个size字节的段, 成功返回段的下标, 失败返回-1. 调用者需持有shm_lock */
+static signed int shm_segment_create(signed int key, unsigned int size)
+{
+    signed int shm_id = 0;
+    while(shm_id < MAX_SHM_SEGMENTS && shm_table[shm_id].page_count != 0)
+        shm_id++;
+    if(shm_id == MAX_SHM_SEGMENTS)
+        return -1;
+    
+    struct shm_segment *seg = &shm_table[shm_id];
+    seg->frames = get_kernel_pages(1);  // 返回的页已清0, 未分配的页框地址为0
+    if(seg->frames == NULL)
+        return -1;
+    
+    seg->key = key;
+    seg->page_count = DIV_ROUND_UP(size, PAGE_SIZE);
+    seg->attach_count = 0;
+    seg->removed = false;
+    
+    // 共享内存段要被多个进程同时映射, 不能按需分配, 创建时就分配好清0的页框
+    unsigned int page_index;
+    for(page_index = 0; page_index < seg->page_count; page_index++)
+    {
+        seg->frames[page_index] = user_frame_alloc();
+        if(seg->frames[page_index] == 0)
+        {
+            shm_segment_free(seg);
+            return -1;
+        }
+    }
+    return shm_id;
+}
+
+
+/* 取得键key对应的共享内存段, 按flag的要求新建, 成功返回段标识, 失败返回-1 */
+signed int sys_shmget(signed int key, unsigned int size, signed int flag)
+{
+    if(size > SHM_MAX_PAGES * PAGE_SIZE)
+        return -1;
+    
+    lock_acquire(&shm_lock);
+    signed int shm_id = -1;
+    if(key != IPC_PRIVATE)
+    {
+        for(shm_id = 0; shm_id < MAX_SHM_SEGMENTS; shm_id++)
+        {
+            struct shm_segment *seg = &shm_table[shm_id];
+            if(seg->page_count != 0 && !seg->removed && seg->key == key)
+                break;
+        }
+        if(shm_id == MAX_SHM_SEGMENTS)
+            shm_id = -1;
+    }
+    
+    if(shm_id != -1)    // 段已存在
+    {
+        if(((flag & IPC_CREAT) && (flag & IPC_EXCL)) || DIV_ROUND_UP(size, PAGE_SIZE) > shm_table[shm_id].page_count)
+            shm_id = -1;
+    }
+    else if((key == IPC_PRIVATE || (flag & IPC_CREAT)) && size > 0)
+        shm_id = shm_segment_create(key, size);
+    
+    lock_release(&shm_lock);
+    return shm_id;
+}
+
+
+/* 把段shm_id挂接到当前进程的用户空间, 成功返回挂接的起始地址, 失败返回(void *)-1
+ * addr只作提示, 地址由内核选择 */
+void *sys_shmat(signed int shm_id, const void *addr, signed int flag)
+{
+    (void)addr;
+    struct task_struct *current = running_thread();
+    if(current->pgdir == NULL || shm_id < 0 || shm_id >= MAX_SHM_SEGMENTS)
+        return (void *)-1;
+    
+    lock_acquire(&shm_lock);
+    struct shm_segment *seg = &shm_table[shm_id];
+    if(seg->page_count == 0 || seg->removed)
+    {
+        lock_release(&shm_lock);
+        return (void *)-1;
+    }
+    
+    unsigned int start = vaddr_region_alloc(current, seg->page_count);
+    if(start == 0)
+    {
+        lock_release(&shm_lock);
+        return (void *)-1;
+    }
+    
+    bool writable = !(flag & SHM_RDONLY);
+    struct vm_area *area = vm_area_create(current, start, start + seg->page_count * PAGE_SIZE, \
+                                          VM_SHARED | (writable ? VM_WRITE : 0), NULL, 0, 0, 0);
+    if(area == NULL)
+    {
+        vaddr_region_remove(current, start, seg->page_count);
+        lock_release(&shm_lock);
+        return (void *)-1;
+    }
+    area->shm_id = shm_id;
+    seg->attach_count++;
+    
+    // 各页都已映射, 访问时不会再经过区域的缺页处理
+    unsigned int page_index;
+    for(page_index = 0; page_index < seg->page_count; page_index++)
+        map_shared_user_page(start + page_index * PAGE_SIZE, seg->frames[page_index], writable);
+    
+    lock_release(&shm_lock);
+    return (void *)start;
+}
+
+
+/* 把挂接在addr处的共享内存段从当前进程中脱离, 成功返回0, 失败返回-1 */
+signed int sys_shmdt(const void *addr)
+{
+    struct task_struct *current = running_thread();
+    struct vm_area *area = vm_area_find(current, (unsigned int)addr);
+    if(current->pgdir == NULL || area == NULL || area->shm_id == -1 || area->start != (unsigned int)addr)
+        return -1;
+    
+    lock_acquire(&shm_lock);
+    unsigned int page_count = (area->end - area->start) / PAGE_SIZE;
+    vm_area_destroy(area);      // 挂接数减1, 已删除的段可能就此释放
+    free_user_pages((void *)addr, page_count);
+    lock_release(&shm_lock);
+    return 0;
+}
+
+
+/* 控制共享内存段shm_id, 目前只支持IPC_RMID, 成功返回0, 失败返回-1 */
+signed int sys_shmctl(signed int shm_id, signed int cmd, void *buf)
+{
+    (void)buf;
+    if(shm_id < 0 || shm_id >= MAX_SHM_SEGMENTS || cmd != IPC_RMID)
+        return -1;
+    
+    lock_acquire(&shm_lock);
+    struct shm_segment *seg = &shm_table[shm_id];
+    if(seg->page_count == 0 || seg->removed)
+    {
+        lock_release(&shm_lock);
+        return -1;
+    }
+    
+    // 段在最后一个进程脱离后才释放
+    seg->removed = true;
+    if(seg->attach_count == 0)
+        shm_segment_free(seg);
+    lock_release(&shm_lock);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef __USER_SHM_H
+#define __USER_SHM_H
+
+/* System V风格的共享内存段
+ * 段的页框在创建时分配, 挂接(shmat)时直接映射到进程的用户空间, 各进程访问的是同一组页框,
+ * 不需要像管道那样在内核中逐字节拷贝 */
+
+#define IPC_PRIVATE     0           // 总是新建段, 此段不能再按键找到
+
+/* shmget的flag */
+#define IPC_CREAT       01000       // 键对应的段不存在时新建
+#define IPC_EXCL        02000       // 与IPC_CREAT一起使用, 段已存在则失败
+
+/* shmat的flag */
+#define SHM_RDONLY      010000      // 只读挂接
+
+/* shmctl的cmd */
+#define IPC_RMID        0           // 删除段, 所有进程都脱离后才释放页框
+
+#define MAX_SHM_SEGMENTS    16      // 系统中最多的共享内存段数
+#define SHM_MAX_PAGES       1024    // 每段最多1024页即4MB, 页框地址数组正好占1页
+
+void shm_init(void);
+void shm_attach_get(signed int shm_id);
+void shm_attach_put(signed int shm_id);
+
+signed int sys_shmget(signed int key, unsigned int size, signed int flag);
+void *sys_shmat(signed int shm_id, const void *addr, signed int flag);
+signed int sys_shmdt(const void *addr);
+signed int sys_shmctl(signed int shm_id, signed int cmd, void *buf);
+
+#endif
@@ -22,8 +22,12 @@
 
 #include "fs.h"         // sys_help
 
+#include "mmap.h"       // sys_mmap sys_munmap sys_brk
+#include "shm.h"        // sys_shmget sys_shmat sys_shmdt sys_shmctl
+#include "heap_profile.h"   // sys_heapprof
+
 // 最大支持的系统调用子功能个数
-#define syscall_number  32
+#define syscall_number  64
 
 void *syscall_table[syscall_number];
 
@@ -68,6 +72,19 @@ void syscall_init(void)
 
     syscall_table[SYS_HELP] = sys_help;
     
+    syscall_table[SYS_MMAP] = sys_mmap;
+    syscall_table[SYS_MUNMAP] = sys_munmap;
+    syscall_table[SYS_MSYNC] = sys_msync;
+    
+    syscall_table[SYS_SHMGET] = sys_shmget;
+    syscall_table[SYS_SHMAT] = sys_shmat;
+    syscall_table[SYS_SHMDT] = sys_shmdt;
+    syscall_table[SYS_SHMCTL] = sys_shmctl;
+    
+    syscall_table[SYS_BRK] = sys_brk;
+    syscall_table[SYS_MEMINFO] = sys_meminfo;
+    syscall_table[SYS_HEAPPROF] = sys_heapprof;
+    
     // put_str("syscall_init done!\n");
     put_str(" done!\n");
 }
@@ -7,68 +7,24 @@
 
 #include "pipe.h"       // is_pipe
 #include "file.h"       // file_table
+#include "vm_area.h"    // vm_areas_release
+#include "vaddr_region.h"   // vaddr_regions_release
 
 /* 释放用户进程资源: 
  * 1 页表中对应的物理页
- * 2 虚拟内存池占物理页框
+ * 2 虚拟地址区域占的内核内存
  * 3 关闭打开的文件 */
 static void release_prog_resourece(struct task_struct *release_thread)
 {
-    unsigned int *pgdir_vaddr = release_thread->pgdir;
+    // 回收用户空间中的页框及页表, 与其它进程写时复制共享的页框只减少引用计数
+    // 进程是自己调用exit的, 当前的页表就是release_thread的页表
+    ASSERT(release_thread == running_thread());
+    vm_areas_sync(release_thread, 0, 0xc0000000);   // 共享文件映射中改过的页写回文件
+    release_user_space();
+    vm_areas_release(release_thread);
     
-    // 页目录表PDT
-    // 用户空间3G, 768*4M/1024 = 3G
-    unsigned short int user_pde_count = 768, pde_index = 0;
-    unsigned int pde = 0;
-    unsigned int *var_pde_ptr = NULL;   // 和函数 pde_ptr 区分
-    
-    // 页表
-    unsigned short int user_pte_count = 1024, pte_index = 0;
-    unsigned int pte = 0;
-    unsigned int *var_pte_ptr = NULL;   // 和函数 pte_ptr 区分
-    
-    unsigned int *first_pte_vaddr_in_pde = NULL; // pde中第0个pte的地址
-    unsigned int page_phy_addr = 0;
-    
-    // 回收页表中用户空间的页框
-    while(pde_index < user_pde_count)   // 外层循环遍历页目录表中的pde
-    {
-        var_pde_ptr = pgdir_vaddr + pde_index;    // 指针按类型加减
-        pde = *var_pde_ptr;     // 页目录表项的值
-        
-        // 如果页目录项P位为1, 表示该页目录项下可能有页表项
-        // 在回收内存空间时, 页表中的pte有可能被回收干净了, 但该页表所在的pde还在
-        // 当初是为了减少页表的频繁变动而有意为之
-        if(pde & 0x00000001)
-        {
-            // 一个页目录表项表示的内存容量为4M, 即 0x400000
-            // pde_index*4M 为虚拟线性地址, 调用pte_ptr得到虚拟地址对应的页表项指针
-            // 这里为 页表的基地址
-            first_pte_vaddr_in_pde = pte_ptr(pde_index * 0x400000);
-            pte_index = 0;
-            while(pte_index < user_pte_count)   // 内层循环遍历页表中的pte
-            {
-                var_pte_ptr = first_pte_vaddr_in_pde + pte_index; // 指针按类型加减
-                pte = *var_pte_ptr;     // 页表项的值, 即物理页的起始地址
-                if(pte & 0x00000001)    // 表示分配了物理页
-                {
-                    // 将pte中记录的物理页框直接在相应内存池的位图中清0
-                    page_phy_addr = pte & 0xfffff000;
-                    free_a_phy_page(page_phy_addr);
-                }
-                pte_index++;
-            }
-            // 将pde中记录的物理页框直接在相应内存池的位图中清0
-            page_phy_addr = pde & 0xfffff000;
-            free_a_phy_page(page_phy_addr);
-        }
-        pde_index++;
-    }
-    
-    // 回收用户虚拟地址池所占的物理内存
-    unsigned int bitmap_page_count = (release_thread->user_vaddr.vaddr_bitmap.bitmap_bytes_len) / PAGE_SIZE;
-    unsigned char *user_vaddr_pool_bitmap = release_thread->user_vaddr.vaddr_bitmap.bits;
-    mfree_page(PF_KERNEL, user_vaddr_pool_bitmap, bitmap_page_count);
+    // 回收虚拟地址区域, 页表释放时要用到, 所以放在最后
+    vaddr_regions_release(release_thread);
     
     // 关闭进程打开的文件
     unsigned char fd_index = 3;